@@ -0,0 +1,326 @@
+/**
+ * dns_stub.c
+ *
+ * A DNS server for testing the lookup functions, which answers every query
+ * after a fixed latency from a made up zone instead of asking anyone:
+ *
+ *   hN.stub.test                   A 10.x.y.z, with x.y.z being N below 2^24
+ *   z.y.x.10.in-addr.arpa          PTR hN.stub.test
+ *
+ * Other names do not exist, and hN.stub.test has no other records. Answers
+ * are sent in the order the queries came in, so a lookup that is not
+ * answered yet does not hold up the others, however long the latency.
+ *
+ * Usage: dns_stub [-a address] [-p port] [-l milliseconds] [-x percent]
+ *
+ *   -a  address to listen on, 127.0.0.1 by default
+ *   -p  UDP port to listen on, 53 by default
+ *   -l  latency of every answer, 0 by default
+ *   -x  percentage of queries to leave unanswered, to test timeouts
+ *
+ * On SIGINT or SIGTERM it writes the number of queries to stderr and exits.
+ * See dns_test.sh for running the lookup functions against it.
+ *
+ * Copyright (c) 2011 WatchMouse
+ *
+ * Licensed under the EUPL, Version 1.1 or – as soon they will be approved
+ * by the European Commission - subsequent versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the Licence. You may
+ * obtain a copy of the Licence at:
+ *
+ *   http://ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define ZONE "stub.test"
+#define PACKET_LEN 512
+#define MAX_PENDING 65536
+
+#define TYPE_A 1
+#define TYPE_PTR 12
+#define RCODE_NXDOMAIN 3
+
+// an answer waiting for its time
+typedef struct
+{
+    long long due;
+    struct sockaddr_in to;
+    uint16_t length;
+    unsigned char packet[PACKET_LEN];
+} stub_answer;
+
+static stub_answer *pending;
+static unsigned long head, tail;
+static unsigned long long queries, answered, dropped;
+static volatile sig_atomic_t stop;
+
+static void die(const char *what)
+{
+    fprintf(stderr, "dns_stub: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+static void on_signal(int sig __attribute__((unused)))
+{
+    stop = 1;
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Read the name at p of packet q into name, lowercase with dots between the
+ * labels. Queries have no compressed names.
+ *
+ * @return the end of the name in q, NULL if invalid
+ */
+static const unsigned char *read_name(const unsigned char *p, const unsigned char *end, char *name, size_t size)
+{
+    size_t used = 0;
+
+    while (p < end && *p)
+    {
+        uint length = *p++;
+
+        if (length > 63 || p + length > end || used + length + 2 > size)
+            return NULL;
+        if (used)
+            name[used++] = '.';
+        while (length--)
+            name[used++] = tolower(*p++);
+    }
+    if (p == end)
+        return NULL;
+    name[used] = '\0';
+    return p + 1;
+}
+
+// write name in labels, as DNS wants it
+static unsigned char *write_name(unsigned char *p, const char *name)
+{
+    const char *dot;
+
+    for (; *name; name = *dot ? dot + 1 : dot)
+    {
+        if (!(dot = strchr(name, '.')))
+            dot = name + strlen(name);
+        *p++ = dot - name;
+        memcpy(p, name, dot - name);
+        p += dot - name;
+    }
+    *p++ = 0;
+    return p;
+}
+
+// N of hN.stub.test, -1 for other names
+static long host_number(const char *name)
+{
+    char *end;
+    long n;
+
+    if (name[0] != 'h' || !isdigit((unsigned char) name[1]))
+        return -1;
+    n = strtol(name + 1, &end, 10);
+    if (n >= 1 << 24 || strcmp(end, "." ZONE))
+        return -1;
+    return n;
+}
+
+// N of z.y.x.10.in-addr.arpa, -1 for other names
+static long reverse_number(const char *name)
+{
+    uint x, y, z;
+    int used = 0;
+
+    if (sscanf(name, "%3u.%3u.%3u.10.in-addr.arpa%n", &z, &y, &x, &used) != 3 || name[used]
+            || x > 255 || y > 255 || z > 255)
+        return -1;
+    return (x << 16) | (y << 8) | z;
+}
+
+/**
+ * Answer the query of length bytes in q into a.
+ *
+ * @return 0, or -1 to ignore the query
+ */
+static int answer(stub_answer *a, const unsigned char *q, size_t length)
+{
+    const unsigned char *end = q + length, *p;
+    unsigned char *r = a->packet;
+    char name[256], host[64];
+    uint type;
+    long n = -1;
+
+    // one question, and not an answer itself
+    if (length < 12 || (q[2] & 0x80) || q[4] || q[5] != 1)
+        return -1;
+    if (!(p = read_name(q + 12, end, name, sizeof(name))) || p + 4 > end)
+        return -1;
+    type = (p[0] << 8) | p[1];
+    p += 4;
+
+    // header and question as they came, then the answer if any
+    memcpy(r, q, p - q);
+    r[2] = 0x84 | (q[2] & 0x01);            // answer, authoritative, recursion desired as asked
+    r[3] = 0x80;                            // recursion available
+    r[6] = r[7] = r[8] = r[9] = r[10] = r[11] = 0;
+    r += p - q;
+
+    if ((n = host_number(name)) >= 0)
+    {
+        if (type == TYPE_A)
+        {
+            static const unsigned char rr[] = { 0xc0, 12, 0, TYPE_A, 0, 1, 0, 0, 0, 60, 0, 4, 10 };
+
+            memcpy(r, rr, sizeof(rr));
+            r += sizeof(rr);
+            *r++ = n >> 16;
+            *r++ = n >> 8;
+            *r++ = n;
+            a->packet[7] = 1;
+        }
+    }
+    else if ((n = reverse_number(name)) >= 0)
+    {
+        if (type == TYPE_PTR)
+        {
+            static const unsigned char rr[] = { 0xc0, 12, 0, TYPE_PTR, 0, 1, 0, 0, 0, 60 };
+            unsigned char *rdlength;
+
+            memcpy(r, rr, sizeof(rr));
+            r += sizeof(rr);
+            rdlength = r;
+            r += 2;
+            sprintf(host, "h%ld." ZONE, n);
+            r = write_name(r, host);
+            rdlength[0] = (r - rdlength - 2) >> 8;
+            rdlength[1] = r - rdlength - 2;
+            a->packet[7] = 1;
+        }
+    }
+    else
+        a->packet[3] |= RCODE_NXDOMAIN;
+
+    a->length = r - a->packet;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in sa;
+    const char *address = "127.0.0.1";
+    long latency = 0, drop = 0, port = 53;
+    struct sigaction act;
+    int fd, opt;
+
+    while ((opt = getopt(argc, argv, "a:p:l:x:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            address = optarg;
+            break;
+        case 'p':
+            port = strtol(optarg, NULL, 10);
+            break;
+        case 'l':
+            latency = strtol(optarg, NULL, 10);
+            break;
+        case 'x':
+            drop = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: dns_stub [-a address] [-p port] [-l milliseconds] [-x percent]\n");
+            return 2;
+        }
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &sa.sin_addr) != 1)
+    {
+        fprintf(stderr, "dns_stub: invalid address %s\n", address);
+        return 2;
+    }
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        die("socket");
+    if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)))
+        die(address);
+    if (!(pending = malloc(MAX_PENDING * sizeof(*pending))))
+        die("malloc");
+
+    // no SA_RESTART, so that poll() returns on a signal
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = on_signal;
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+    srand(getpid());
+
+    fprintf(stderr, "dns_stub: answering on %s port %ld after %ld ms\n", address, port, latency);
+
+    while (!stop)
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        long long t = now_ms();
+        int timeout = -1;
+
+        // answers are due in the order the queries came in
+        while (head != tail && pending[head % MAX_PENDING].due <= t)
+        {
+            stub_answer *a = &pending[head++ % MAX_PENDING];
+
+            sendto(fd, a->packet, a->length, 0, (struct sockaddr *) &a->to, sizeof(a->to));
+            answered++;
+        }
+        if (head != tail)
+            timeout = pending[head % MAX_PENDING].due - t;
+
+        if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN))
+        {
+            unsigned char q[PACKET_LEN];
+            socklen_t from_length = sizeof(sa);
+            stub_answer *a = &pending[tail % MAX_PENDING];
+            ssize_t n;
+
+            if ((n = recvfrom(fd, q, sizeof(q), 0, (struct sockaddr *) &a->to, &from_length)) <= 0)
+                continue;
+            queries++;
+            if (tail - head == MAX_PENDING || (drop && rand() % 100 < drop) || answer(a, q, n))
+            {
+                dropped++;
+                continue;
+            }
+            a->due = now_ms() + latency;
+            tail++;
+        }
+    }
+
+    fprintf(stderr, "dns_stub: %llu queries, %llu answered, %llu dropped\n", queries, answered, dropped);
+    return 0;
+}
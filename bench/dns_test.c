@@ -0,0 +1,231 @@
+/**
+ * dns_test.c
+ *
+ * Run inet6_lookup(), inet6_rlookup() and their prefetch functions against
+ * dns_stub, and check and time what they return. Run it with dns_test.sh,
+ * which points the resolver at the stub.
+ *
+ * Usage: dns_test [-n names] [-c cold]
+ *
+ *   -n  names and addresses to prefetch, 300 by default
+ *   -c  names to look up without a prefetch first, 20 by default
+ *
+ * Each of the names and addresses is prefetched in one query, and then
+ * looked up in another, which should find all of them in the cache. The
+ * cold names are looked up one at a time, as a query does without a
+ * prefetch. Failures are written to stderr, and make the exit status 1.
+ *
+ * Copyright (c) 2011 WatchMouse
+ *
+ * Licensed under the EUPL, Version 1.1 or – as soon they will be approved
+ * by the European Commission - subsequent versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the Licence. You may
+ * obtain a copy of the Licence at:
+ *
+ *   http://ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+// drives the functions the way a query does
+#include "../mysql_udf_ipv6.c"
+
+typedef my_bool (*init_fn)(UDF_INIT *initid, UDF_ARGS *args, char *message);
+
+// the rows of a query, and the argument to pass them in
+typedef struct
+{
+    UDF_INIT initid;
+    UDF_ARGS args;
+    enum Item_result type;
+    char *value;
+    unsigned long length;
+    char maybe_null, message[MYSQL_ERRMSG_SIZE];
+} test_query;
+
+static unsigned long failures;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void query_init(test_query *q, init_fn init)
+{
+    memset(q, 0, sizeof(*q));
+    q->type = STRING_RESULT;
+    q->maybe_null = 1;
+    q->args.arg_count = 1;
+    q->args.arg_type = &q->type;
+    q->args.args = &q->value;
+    q->args.lengths = &q->length;
+    q->args.maybe_null = &q->maybe_null;
+    if (init(&q->initid, &q->args, q->message))
+    {
+        fprintf(stderr, "dns_test: %s\n", q->message);
+        exit(1);
+    }
+}
+
+static void set_row(test_query *q, char *value, unsigned long length)
+{
+    q->value = value;
+    q->length = length;
+}
+
+// host name of the stub for n, and its address in binary and presentation form
+static void stub_host(uint n, char *host, char *binary, char *address)
+{
+    sprintf(host, "h%u.stub.test", n);
+    binary[0] = 10;
+    binary[1] = n >> 16;
+    binary[2] = n >> 8;
+    binary[3] = n;
+    sprintf(address, "10.%u.%u.%u", (n >> 16) & 0xff, (n >> 8) & 0xff, n & 0xff);
+}
+
+static void check(const char *udf, const char *arg, const char *value, unsigned long length, const char *expect)
+{
+    if (!value || length != strlen(expect) || memcmp(value, expect, length))
+    {
+        fprintf(stderr, "dns_test: %s(%s) returned %.*s, expected %s\n", udf, arg,
+                value ? (int) length : 4, value ? value : "NULL", expect);
+        failures++;
+    }
+}
+
+/**
+ * Prefetch count names or addresses starting at first in one query, then
+ * look them all up in another.
+ */
+static void prefetch_then_lookup(int reverse, uint first, uint count)
+{
+    char host[64], binary[INET_ADDRLEN], address[INET_ADDRSTRLEN], result[NI_MAXHOST];
+    const char *udf = reverse ? "inet6_rlookup" : "inet6_lookup";
+    char is_null = 0, error = 0;
+    unsigned long length;
+    test_query q;
+    double start, prefetched;
+    long long queued;
+    uint i;
+
+    query_init(&q, reverse ? inet6_rlookup_prefetch_init : inet6_lookup_prefetch_init);
+    start = now();
+    (reverse ? inet6_rlookup_prefetch_clear : inet6_lookup_prefetch_clear)(&q.initid, &is_null, &error);
+    for (i = first; i < first + count; i++)
+    {
+        stub_host(i, host, binary, address);
+        if (reverse)
+            set_row(&q, binary, INET_ADDRLEN);
+        else
+            set_row(&q, host, strlen(host));
+        (reverse ? inet6_rlookup_prefetch_add : inet6_lookup_prefetch_add)(&q.initid, &q.args, &is_null, &error);
+    }
+    queued = (reverse ? inet6_rlookup_prefetch : inet6_lookup_prefetch)(&q.initid, &q.args, &is_null, &error);
+    prefetched = now() - start;
+    (reverse ? inet6_rlookup_prefetch_deinit : inet6_lookup_prefetch_deinit)(&q.initid);
+    if (queued != count)
+    {
+        fprintf(stderr, "dns_test: %s_prefetch resolved %lld of %u\n", udf, queued, count);
+        failures++;
+    }
+
+    query_init(&q, reverse ? inet6_rlookup_init : inet6_lookup_init);
+    start = now();
+    for (i = first; i < first + count; i++)
+    {
+        const char *value;
+
+        stub_host(i, host, binary, address);
+        if (reverse)
+            set_row(&q, binary, INET_ADDRLEN);
+        else
+            set_row(&q, host, strlen(host));
+        is_null = 0;
+        value = (reverse ? inet6_rlookup : inet6_lookup)(&q.initid, &q.args, result, &length, &is_null, &error);
+        check(udf, reverse ? address : host, is_null ? NULL : value, length, reverse ? host : address);
+    }
+    printf("%s_prefetch\t%u\t%.3f s\n%s\t%u\t%.3f s\n", udf, count, prefetched, udf, count, now() - start);
+    (reverse ? inet6_rlookup_deinit : inet6_lookup_deinit)(&q.initid);
+}
+
+// look up count names starting at first one at a time, nothing prefetched
+static void lookup_cold(uint first, uint count)
+{
+    char host[64], binary[INET_ADDRLEN], address[INET_ADDRSTRLEN], result[NI_MAXHOST];
+    char is_null, error = 0;
+    unsigned long length;
+    const char *value;
+    test_query q;
+    double start;
+    uint i;
+
+    query_init(&q, inet6_lookup_init);
+    start = now();
+    for (i = first; i < first + count; i++)
+    {
+        stub_host(i, host, binary, address);
+        set_row(&q, host, strlen(host));
+        is_null = 0;
+        value = inet6_lookup(&q.initid, &q.args, result, &length, &is_null, &error);
+        check("inet6_lookup", host, is_null ? NULL : value, length, address);
+    }
+    printf("inet6_lookup_cold\t%u\t%.3f s\n", count, now() - start);
+    inet6_lookup_deinit(&q.initid);
+
+    // a name that does not exist
+    query_init(&q, inet6_lookup_init);
+    set_row(&q, "nosuchhost.stub.test", strlen("nosuchhost.stub.test"));
+    is_null = 0;
+    value = inet6_lookup(&q.initid, &q.args, result, &length, &is_null, &error);
+    if (!is_null)
+    {
+        fprintf(stderr, "dns_test: inet6_lookup(nosuchhost.stub.test) returned %.*s\n", (int) length, value);
+        failures++;
+    }
+    inet6_lookup_deinit(&q.initid);
+}
+
+int main(int argc, char **argv)
+{
+    uint names = 300, cold = 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            names = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            cold = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: dns_test [-n names] [-c cold]\n");
+            return 2;
+        }
+    }
+
+    // names and addresses of their own, so that none is cached by another
+    prefetch_then_lookup(0, 1, names);
+    prefetch_then_lookup(1, 1 + names, names);
+    lookup_cold(1 + 2 * names, cold);
+    fflush(stdout);
+
+    if (failures)
+    {
+        fprintf(stderr, "dns_test: %lu failures\n", failures);
+        return 1;
+    }
+    fprintf(stderr, "dns_test: all passed\n");
+    return 0;
+}
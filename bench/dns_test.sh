@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+# dns_test.sh
+#
+# Run bench/dns_test against bench/dns_stub, with the resolver of the test
+# pointed at the stub. This bind-mounts a resolv.conf naming the stub over
+# /etc/resolv.conf in a mount namespace of its own, so it needs root, and
+# leaves the resolver of the rest of the system alone.
+#
+# Usage: bench/dns_test.sh [-l milliseconds] [-x percent] [dns_test options]
+#
+#   -l  latency of the stub, 200 milliseconds by default
+#   -x  percentage of queries the stub leaves unanswered, 0 by default
+#
+# Other options go to dns_test, like -n 1000 to prefetch 1000 names. The
+# settings of the functions are taken from the environment as usual, like
+# INET6_DNS_THREADS=64.
+#
+# Copyright (c) 2011 WatchMouse
+#
+# Licensed under the EUPL, Version 1.1 or – as soon they will be approved
+# by the European Commission - subsequent versions of the EUPL (the "Licence");
+# You may not use this work except in compliance with the Licence. You may
+# obtain a copy of the Licence at:
+#
+#   http://ec.europa.eu/idabc/eupl
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the Licence is distributed on an "AS IS" basis,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the Licence for the specific language governing permissions and
+# limitations under the Licence.
+#
+
+# an address of its own, so as not to clash with a local resolver on port 53
+STUB=127.53.0.1
+LATENCY=200
+DROP=0
+BENCH=$(dirname "$0")
+
+while getopts l:x:n:c: opt; do
+    case $opt in
+    l) LATENCY=$OPTARG ;;
+    x) DROP=$OPTARG ;;
+    n|c) TESTFLAGS="$TESTFLAGS -$opt $OPTARG" ;;
+    *) echo "usage: dns_test.sh [-l milliseconds] [-x percent] [-n names] [-c cold]" >&2; exit 2 ;;
+    esac
+done
+
+if [ -z "$DNS_TEST_NAMESPACE" ]; then
+    DNS_TEST_NAMESPACE=1 exec unshare --mount "$0" "$@"
+fi
+
+CONF=$(mktemp) || exit 1
+printf 'nameserver %s\noptions timeout:2 attempts:2\n' $STUB > "$CONF"
+mount --bind "$CONF" /etc/resolv.conf || exit 1
+
+"$BENCH/dns_stub" -a $STUB -l "$LATENCY" -x "$DROP" &
+STUB_PID=$!
+sleep 0.2
+
+"$BENCH/dns_test" $TESTFLAGS
+STATUS=$?
+
+kill $STUB_PID
+wait $STUB_PID
+rm -f "$CONF"
+exit $STATUS
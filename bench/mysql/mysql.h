@@ -0,0 +1,59 @@
+/**
+ * mysql.h
+ *
+ * The part of the MySQL headers the UDFs use, so that udf_bench can be built
+ * without the client library installed. The layout matches the one of the
+ * server, but nothing here is ever passed to a server.
+ *
+ * Copyright (c) 2011 WatchMouse
+ *
+ * Licensed under the EUPL, Version 1.1 or – as soon they will be approved
+ * by the European Commission - subsequent versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the Licence. You may
+ * obtain a copy of the Licence at:
+ *
+ *   http://ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#ifndef UDF_BENCH_MYSQL_H
+#define UDF_BENCH_MYSQL_H
+
+#define MYSQL_ERRMSG_SIZE 512
+
+typedef char my_bool;
+
+enum Item_result
+{
+    STRING_RESULT = 0, REAL_RESULT, INT_RESULT, ROW_RESULT, DECIMAL_RESULT
+};
+
+typedef struct st_udf_args
+{
+    unsigned int arg_count;
+    enum Item_result *arg_type;
+    char **args;
+    unsigned long *lengths;
+    char *maybe_null;
+    char **attributes;
+    unsigned long *attribute_lengths;
+    void *extension;
+} UDF_ARGS;
+
+typedef struct st_udf_init
+{
+    my_bool maybe_null;
+    unsigned int decimals;
+    unsigned long max_length;
+    char *ptr;
+    my_bool const_item;
+    void *extension;
+} UDF_INIT;
+
+#endif
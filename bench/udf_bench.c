@@ -0,0 +1,837 @@
+/**
+ * udf_bench.c
+ *
+ * Benchmark the MySQL functions without a server. Each function is driven the
+ * way a query drives it: its init function, the row function for every row of
+ * a synthetic workload and its deinit function, with all rows as one group for
+ * aggregate functions. Queries are repeated for a minimum time per workload.
+ *
+ * Usage: udf_bench [-n rows] [-t milliseconds] [-f filter] [-c baseline [-r percent]]
+ *                  [-l table.lpm] [-p list.psl]
+ *
+ *   -n  rows per query, 4096 by default
+ *   -t  minimum time per workload, 200 milliseconds by default
+ *   -f  only run workloads with the filter in their name, like inet6_pton
+ *   -c  compare with the output of an earlier run
+ *   -r  exit with status 1 when a workload got slower than the baseline by
+ *       more than percent
+ *   -l  also run inet6_lpm_lookup() with a table made with inet6_lpm_compile
+ *   -p  also run idna_public_suffix() and idna_registrable_domain() with a
+ *       list made with idna_psl_compile
+ *
+ * Results are written as tab separated lines of the workload, the number of
+ * rows, nanoseconds per row, rows per second and allocations per row, which
+ * can be saved as the baseline of a later run. Allocations are counted by
+ * wrapping malloc() and friends at link time, see the bench target of the
+ * Makefile, so allocations within libidn and libc are not counted.
+ *
+ * The functions resolving host names are left out, as they would measure the
+ * resolver. The conversions of idna_to_ascii() and idna_from_ascii() are cached,
+ * so use more rows than the cache holds to measure the conversions themselves.
+ *
+ * Copyright (c) 2011 WatchMouse
+ *
+ * Licensed under the EUPL, Version 1.1 or – as soon they will be approved
+ * by the European Commission - subsequent versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the Licence. You may
+ * obtain a copy of the Licence at:
+ *
+ *   http://ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <mysql/mysql.h>
+
+// the size of the result buffer MySQL passes to string functions
+#define RESULT_LEN 255
+
+#define MAX_ARGS 3
+#define MAX_CASES 128
+
+typedef void (*udf_fn)(void);
+typedef my_bool (*init_fn)(UDF_INIT *initid, UDF_ARGS *args, char *message);
+typedef void (*deinit_fn)(UDF_INIT *initid);
+typedef char *(*string_fn)(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *length,
+        char *null_value, char *error);
+typedef long long (*int_fn)(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *error);
+typedef void (*clear_fn)(UDF_INIT *initid, char *is_null, char *error);
+typedef void (*add_fn)(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *error);
+
+#define DECLARE_SCALAR(f, type) \
+    my_bool f##_init(UDF_INIT *initid, UDF_ARGS *args, char *message); \
+    void f##_deinit(UDF_INIT *initid); \
+    type f
+#define DECLARE_STRING(f) \
+    DECLARE_SCALAR(f, char *)(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *length, \
+            char *null_value, char *error)
+#define DECLARE_INTEGER(f) \
+    DECLARE_SCALAR(f, long long)(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *error)
+#define DECLARE_AGGREGATE(f) \
+    void f##_clear(UDF_INIT *initid, char *is_null, char *error); \
+    void f##_add(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *error)
+
+DECLARE_STRING(inet6_pton);
+DECLARE_STRING(inet6_ntop);
+DECLARE_STRING(inet6_aton);
+DECLARE_STRING(inet6_ntoa);
+DECLARE_STRING(inet6_mask);
+DECLARE_STRING(inet6_network);
+DECLARE_STRING(inet6_broadcast);
+DECLARE_STRING(inet6_hostmask);
+DECLARE_INTEGER(inet6_in_cidr);
+DECLARE_INTEGER(inet6_match);
+DECLARE_INTEGER(inet6_match_index);
+DECLARE_STRING(inet6_lpm_lookup);
+DECLARE_STRING(inet6_collapse);
+DECLARE_AGGREGATE(inet6_collapse);
+DECLARE_INTEGER(inet6_approx_distinct);
+DECLARE_AGGREGATE(inet6_approx_distinct);
+DECLARE_STRING(inet6_approx_sketch);
+DECLARE_AGGREGATE(inet6_approx_sketch);
+DECLARE_STRING(inet6_approx_merge);
+DECLARE_AGGREGATE(inet6_approx_merge);
+DECLARE_INTEGER(inet6_approx_count);
+DECLARE_STRING(inet6_topk);
+DECLARE_AGGREGATE(inet6_topk);
+DECLARE_STRING(inet6_bloom_build);
+DECLARE_AGGREGATE(inet6_bloom_build);
+DECLARE_INTEGER(inet6_bloom_contains);
+DECLARE_STRING(inet6_key);
+DECLARE_STRING(inet6_range_start);
+DECLARE_STRING(inet6_range_end);
+DECLARE_INTEGER(inet6_hi64);
+DECLARE_INTEGER(inet6_lo64);
+DECLARE_STRING(inet6_anonymize);
+DECLARE_STRING(inet6_truncate);
+DECLARE_INTEGER(inet6_hash);
+DECLARE_INTEGER(inet6_bucket);
+DECLARE_STRING(inet6_canonicalize);
+DECLARE_STRING(inet6_udf_stats);
+DECLARE_STRING(idna_to_ascii);
+DECLARE_STRING(idna_from_ascii);
+DECLARE_STRING(idna_public_suffix);
+DECLARE_STRING(idna_registrable_domain);
+DECLARE_STRING(idna_cache_stats);
+
+// the arguments of each row
+enum
+{
+    POOL_NONE, POOL_IPV4, POOL_IPV6, POOL_IPV6_COMPRESSED, POOL_MIXED, POOL_INVALID, POOL_BINARY,
+    POOL_BINARY_INVALID, POOL_PREFIX, POOL_CIDR, POOL_SKETCH, POOL_ASCII_HOST, POOL_UNICODE_HOST,
+    POOL_PUNYCODE_HOST, POOLS
+};
+
+typedef struct
+{
+    enum Item_result type;
+    char **values;
+    unsigned long *lengths;
+} bench_pool;
+
+/**
+ * A workload: a function and the arguments to call it with. Each argument is
+ * one of
+ *
+ *   p          the value of the row from the pool
+ *   i:number   a constant integer
+ *   r:number   a constant real
+ *   s:string   a constant string
+ *   b          the constant Bloom filter of the mixed pool
+ *   n:count    a constant list of count random networks, see network_list()
+ *   l, P       the constant path given with -l or -p, skipped without it
+ *
+ * A query goes over the pool passes times, once if not given, so that the
+ * work of an init function is spread over as many rows as it would be on a
+ * large table.
+ */
+typedef struct
+{
+    const char *udf, *workload;
+    enum Item_result type;
+    udf_fn init, deinit, func, clear, add;
+    int pool;
+    const char *spec[MAX_ARGS];
+    uint passes;
+} bench_case;
+
+#define STRING(f)           STRING_RESULT, (udf_fn) f##_init, (udf_fn) f##_deinit, (udf_fn) f, NULL, NULL
+#define STRING_NODEINIT(f)  STRING_RESULT, (udf_fn) f##_init, NULL, (udf_fn) f, NULL, NULL
+#define INTEGER(f)          INT_RESULT, (udf_fn) f##_init, (udf_fn) f##_deinit, (udf_fn) f, NULL, NULL
+#define INTEGER_NODEINIT(f) INT_RESULT, (udf_fn) f##_init, NULL, (udf_fn) f, NULL, NULL
+#define STRING_AGGREGATE(f) STRING_RESULT, (udf_fn) f##_init, (udf_fn) f##_deinit, (udf_fn) f, \
+                            (udf_fn) f##_clear, (udf_fn) f##_add
+#define INTEGER_AGGREGATE(f) INT_RESULT, (udf_fn) f##_init, (udf_fn) f##_deinit, (udf_fn) f, \
+                            (udf_fn) f##_clear, (udf_fn) f##_add
+
+#define NETWORKS "10.0.0.0/8, 172.16.0.0/12, 192.168.0.0/16, 100.64.0.0/10, 169.254.0.0/16, " \
+                 "192.0.2.0/24, 198.51.100.0/24, 203.0.113.0/24, 224.0.0.0/4, 240.0.0.0/4, " \
+                 "fc00::/7, fe80::/10, ff00::/8, 2001:db8::/32, 2002::/16, 64:ff9b::/96"
+
+// any 32 bytes will do
+#define CRYPTOPAN_KEY "0123456789abcdef0123456789abcdef"
+
+static const bench_case cases[] =
+{
+    { "inet6_pton", "ipv4", STRING(inet6_pton), POOL_IPV4, { "p" } },
+    { "inet6_pton", "ipv6", STRING(inet6_pton), POOL_IPV6, { "p" } },
+    { "inet6_pton", "ipv6_compressed", STRING(inet6_pton), POOL_IPV6_COMPRESSED, { "p" } },
+    { "inet6_pton", "mixed", STRING(inet6_pton), POOL_MIXED, { "p" } },
+    { "inet6_pton", "invalid", STRING(inet6_pton), POOL_INVALID, { "p" } },
+    { "inet6_pton", "canonical", STRING(inet6_pton), POOL_MIXED, { "p", "s:all" } },
+    { "inet6_aton", "mixed", STRING(inet6_aton), POOL_MIXED, { "p" } },
+    { "inet6_ntop", "mixed", STRING(inet6_ntop), POOL_BINARY, { "p" } },
+    { "inet6_ntop", "invalid", STRING(inet6_ntop), POOL_BINARY_INVALID, { "p" } },
+    { "inet6_ntoa", "mixed", STRING(inet6_ntoa), POOL_BINARY, { "p" } },
+    { "inet6_mask", "mixed", STRING(inet6_mask), POOL_BINARY, { "p", "i:24" } },
+    { "inet6_network", "mixed", STRING(inet6_network), POOL_BINARY, { "p", "i:24" } },
+    { "inet6_broadcast", "mixed", STRING(inet6_broadcast), POOL_BINARY, { "p", "i:24" } },
+    { "inet6_hostmask", "prefix", STRING(inet6_hostmask), POOL_PREFIX, { "p" } },
+    { "inet6_in_cidr", "mixed", INTEGER(inet6_in_cidr), POOL_MIXED, { "p", "s:192.0.0.0/8" } },
+    { "inet6_in_cidr", "binary", INTEGER(inet6_in_cidr), POOL_BINARY, { "p", "s:2001:db8::/32" } },
+    { "inet6_in_cidr", "invalid", INTEGER(inet6_in_cidr), POOL_INVALID, { "p", "s:192.0.0.0/8" } },
+    { "inet6_match", "mixed", INTEGER(inet6_match), POOL_MIXED, { "p", "s:" NETWORKS } },
+    { "inet6_match_index", "mixed", INTEGER(inet6_match_index), POOL_MIXED, { "p", "s:" NETWORKS } },
+    { "inet6_match", "networks_10", INTEGER(inet6_match), POOL_BINARY, { "p", "n:10" }, 16 },
+    { "inet6_match", "networks_1000", INTEGER(inet6_match), POOL_BINARY, { "p", "n:1000" }, 256 },
+    { "inet6_match", "networks_100000", INTEGER(inet6_match), POOL_BINARY, { "p", "n:100000" }, 4096 },
+    { "inet6_match_index", "networks_100000", INTEGER(inet6_match_index), POOL_BINARY,
+            { "p", "n:100000" }, 4096 },
+    { "inet6_lpm_lookup", "mixed", STRING(inet6_lpm_lookup), POOL_MIXED, { "p", "l" } },
+    { "inet6_collapse", "mixed", STRING_AGGREGATE(inet6_collapse), POOL_MIXED, { "p" } },
+    { "inet6_collapse", "prefix", STRING_AGGREGATE(inet6_collapse), POOL_MIXED, { "p", "i:24" } },
+    { "inet6_approx_distinct", "mixed", INTEGER_AGGREGATE(inet6_approx_distinct), POOL_MIXED, { "p" } },
+    { "inet6_approx_sketch", "mixed", STRING_AGGREGATE(inet6_approx_sketch), POOL_MIXED, { "p" } },
+    { "inet6_approx_merge", "sketches", STRING_AGGREGATE(inet6_approx_merge), POOL_SKETCH, { "p" } },
+    { "inet6_approx_count", "sketches", INTEGER(inet6_approx_count), POOL_SKETCH, { "p" } },
+    { "inet6_topk", "mixed", STRING_AGGREGATE(inet6_topk), POOL_MIXED, { "p", "i:16", "i:10" } },
+    { "inet6_bloom_build", "mixed", STRING_AGGREGATE(inet6_bloom_build), POOL_MIXED,
+            { "p", "i:1000000", "r:0.01" } },
+    { "inet6_bloom_contains", "mixed", INTEGER(inet6_bloom_contains), POOL_MIXED, { "b", "p" } },
+    { "inet6_key", "mixed", STRING_NODEINIT(inet6_key), POOL_MIXED, { "p" } },
+    { "inet6_range_start", "cidr", STRING(inet6_range_start), POOL_CIDR, { "p" } },
+    { "inet6_range_end", "cidr", STRING(inet6_range_end), POOL_CIDR, { "p" } },
+    { "inet6_hi64", "mixed", INTEGER_NODEINIT(inet6_hi64), POOL_MIXED, { "p" } },
+    { "inet6_lo64", "mixed", INTEGER_NODEINIT(inet6_lo64), POOL_MIXED, { "p" } },
+    { "inet6_anonymize", "mixed", STRING(inet6_anonymize), POOL_BINARY, { "p", "s:" CRYPTOPAN_KEY } },
+    { "inet6_truncate", "mixed", STRING_NODEINIT(inet6_truncate), POOL_BINARY, { "p", "i:24", "i:48" } },
+    { "inet6_hash", "mixed", INTEGER_NODEINIT(inet6_hash), POOL_MIXED, { "p", "i:48" } },
+    { "inet6_hash", "binary", INTEGER_NODEINIT(inet6_hash), POOL_BINARY, { "p", "i:48" } },
+    { "inet6_bucket", "mixed", INTEGER_NODEINIT(inet6_bucket), POOL_MIXED, { "p", "i:48", "i:64" } },
+    { "inet6_canonicalize", "mixed", STRING(inet6_canonicalize), POOL_BINARY, { "p", "s:all" } },
+    { "inet6_udf_stats", "none", STRING(inet6_udf_stats), POOL_NONE, { NULL } },
+    { "idna_to_ascii", "ascii", STRING(idna_to_ascii), POOL_ASCII_HOST, { "p" } },
+    { "idna_to_ascii", "unicode", STRING(idna_to_ascii), POOL_UNICODE_HOST, { "p" } },
+    { "idna_to_ascii", "latin1", STRING(idna_to_ascii), POOL_ASCII_HOST, { "p", "s:ISO-8859-1" } },
+    { "idna_from_ascii", "ascii", STRING(idna_from_ascii), POOL_ASCII_HOST, { "p" } },
+    { "idna_from_ascii", "punycode", STRING(idna_from_ascii), POOL_PUNYCODE_HOST, { "p" } },
+    { "idna_public_suffix", "ascii", STRING(idna_public_suffix), POOL_ASCII_HOST, { "p", "P" } },
+    { "idna_public_suffix", "unicode", STRING(idna_public_suffix), POOL_UNICODE_HOST, { "p", "P" } },
+    { "idna_registrable_domain", "ascii", STRING(idna_registrable_domain), POOL_ASCII_HOST, { "p", "P" } },
+    { "idna_cache_stats", "none", STRING_NODEINIT(idna_cache_stats), POOL_NONE, { NULL } },
+};
+
+// the state of one query
+typedef struct
+{
+    UDF_INIT initid;
+    UDF_ARGS args;
+    enum Item_result types[MAX_ARGS];
+    char *values[MAX_ARGS];
+    unsigned long lengths[MAX_ARGS];
+    char maybe_null[MAX_ARGS];
+    char *attributes[MAX_ARGS];
+    unsigned long attribute_lengths[MAX_ARGS];
+    long long integers[MAX_ARGS];
+    double reals[MAX_ARGS];
+    char result[RESULT_LEN + 1], message[MYSQL_ERRMSG_SIZE];
+    char *value;                // result of the last row
+    unsigned long length;
+    long long integer;
+    char is_null, error;
+} bench_query;
+
+typedef struct
+{
+    char name[128];
+    double ns_per_row;
+} bench_baseline;
+
+static bench_pool pools[POOLS];
+static uint rows = 4096;
+static char *bloom, *lpm_path, *psl_path;
+static unsigned long bloom_length;
+static struct
+{
+    uint count;
+    char *list;
+} networks[8];
+
+static unsigned long long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *p, size_t size);
+int __real_posix_memalign(void **p, size_t alignment, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    allocations++;
+    return __real_realloc(p, size);
+}
+
+int __wrap_posix_memalign(void **p, size_t alignment, size_t size)
+{
+    allocations++;
+    return __real_posix_memalign(p, alignment, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+    allocations++;
+    return __real_strdup(s);
+}
+
+static void die(const char *what)
+{
+    fprintf(stderr, "udf_bench: %s\n", what);
+    exit(1);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// xorshift64*, the same workloads on every run
+static uint64_t random64(void)
+{
+    static uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
+
+static void pool_set(bench_pool *p, uint i, const void *value, unsigned long length)
+{
+    if (!(p->values[i] = malloc(length + 1)))
+        die("out of memory");
+    memcpy(p->values[i], value, length);
+    p->values[i][length] = '\0';
+    p->lengths[i] = length;
+}
+
+static void random_bytes(unsigned char *dst, size_t length)
+{
+    uint64_t r;
+    size_t i;
+
+    for (i = 0; i < length; i += sizeof(r))
+    {
+        r = random64();
+        memcpy(dst + i, &r, length - i < sizeof(r) ? length - i : sizeof(r));
+    }
+}
+
+// an IPv6 address with a run of zero groups, as inet_ntop() compresses it
+static int random_compressed(char *dst)
+{
+    unsigned char bytes[16];
+    uint start = random64() % 7, count = 2 + random64() % (8 - start - 1);
+
+    random_bytes(bytes, sizeof(bytes));
+    memset(bytes + start * 2, 0, count * 2);
+    inet_ntop(AF_INET6, bytes, dst, INET6_ADDRSTRLEN);
+    return strlen(dst);
+}
+
+static int random_ipv4(char *dst)
+{
+    uint32_t r = (uint32_t) random64();
+
+    return sprintf(dst, "%u.%u.%u.%u", r >> 24, (r >> 16) & 0xff, (r >> 8) & 0xff, r & 0xff);
+}
+
+static int random_invalid(char *dst)
+{
+    uint32_t r = (uint32_t) random64();
+
+    switch (random64() % 6)
+    {
+    case 0:
+        return sprintf(dst, "%u.%u.%u", r >> 24, (r >> 16) & 0xff, r & 0xff);
+    case 1:
+        return sprintf(dst, "%u.%u.%u.%u", r >> 24, (r >> 16) & 0xff, 256 + ((r >> 8) & 0xff), r & 0xff);
+    case 2:
+        return sprintf(dst, "%x::%x::%x", r >> 16, r & 0xffff, r & 0xff);
+    case 3:
+        return sprintf(dst, "1:2:3:4:5:6:7:%x:%x", r >> 16, r & 0xffff);
+    case 4:
+        return sprintf(dst, "2001:db8::%xg", r & 0xffff);
+    default:
+        return sprintf(dst, "host%u.example.com", r);
+    }
+}
+
+/**
+ * A comma separated list of count random networks, half of them IPv4 with
+ * prefixes of 8 to 32 bits and half of them IPv6 in 2000::/3 with prefixes of
+ * 16 to 64 bits. The list is made once for each count, and is the same on
+ * every run whatever workloads run before it.
+ */
+static const char *network_list(uint count)
+{
+    uint64_t state = 0x2545f4914f6cdd1dULL + count;
+    unsigned char bytes[16];
+    char *p;
+    uint i, j, prefix;
+
+    for (i = 0; i < sizeof(networks) / sizeof(*networks) && networks[i].list; i++)
+    {
+        if (networks[i].count == count)
+            return networks[i].list;
+    }
+    if (i == sizeof(networks) / sizeof(*networks))
+        die("too many network lists");
+    if (!(p = networks[i].list = malloc((size_t) count * (INET6_ADDRSTRLEN + 5) + 1)))
+        die("out of memory");
+    networks[i].count = count;
+
+    for (j = 0; j < count; j++)
+    {
+        for (prefix = 0; prefix < sizeof(bytes); prefix += sizeof(state))
+        {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            memcpy(bytes + prefix, &state, sizeof(state));
+        }
+        if (j)
+            *p++ = ',';
+        if (j & 1)
+        {
+            prefix = 8 + bytes[4] % 25;
+            bytes[prefix / 8] &= 0xff00 >> (prefix % 8);
+            memset(bytes + prefix / 8 + (prefix % 8 != 0), 0, 4 - prefix / 8 - (prefix % 8 != 0));
+            inet_ntop(AF_INET, bytes, p, INET6_ADDRSTRLEN);
+        }
+        else
+        {
+            prefix = 16 + bytes[15] % 49;
+            bytes[0] = 0x20 | (bytes[0] & 0x1f);
+            bytes[prefix / 8] &= 0xff00 >> (prefix % 8);
+            memset(bytes + prefix / 8 + (prefix % 8 != 0), 0, 16 - prefix / 8 - (prefix % 8 != 0));
+            inet_ntop(AF_INET6, bytes, p, INET6_ADDRSTRLEN);
+        }
+        p += strlen(p);
+        p += sprintf(p, "/%u", prefix);
+    }
+    *p = '\0';
+    return networks[i].list;
+}
+
+static const char *tlds[] = { "com", "net", "org", "co.uk", "de", "nl", "com.au", "jp" };
+static const char *labels[] =
+{
+    "b\xc3\xbc" "cher", "m\xc3\xbcnchen", "k\xc3\xb6ln", "caf\xc3\xa9",
+    "\xd0\xbf\xd1\x80\xd0\xb8\xd0\xbc\xd0\xb5\xd1\x80",
+    "\xce\xb4\xce\xbf\xce\xba\xce\xb9\xce\xbc\xce\xae",
+    "\xe4\xbe\x8b\xe3\x81\x88", "\xe3\x83\x86\xe3\x82\xb9\xe3\x83\x88"
+};
+
+
+/**
+ * Run one query of a workload over count rows of its pool, starting at first.
+ * The result of the last row, or of the group, is left in q.
+ *
+ * @return 0, or -1 with q->message set if the init function failed
+ */
+static int query_run(bench_query *q, const bench_case *c, uint first, uint count)
+{
+    bench_pool *p = &pools[c->pool];
+    int pooled = -1;
+    uint i, pass;
+
+    memset(&q->initid, 0, sizeof(q->initid));
+    memset(&q->args, 0, sizeof(q->args));
+    q->args.arg_type = q->types;
+    q->args.args = q->values;
+    q->args.lengths = q->lengths;
+    q->args.maybe_null = q->maybe_null;
+    q->args.attributes = q->attributes;
+    q->args.attribute_lengths = q->attribute_lengths;
+    q->initid.maybe_null = 1;
+    q->initid.max_length = RESULT_LEN;
+
+    // constants are known to the init function, the pool argument is not
+    for (i = 0; i < MAX_ARGS && c->spec[i]; i++)
+    {
+        const char *s = c->spec[i];
+
+        q->attributes[i] = (char *) s;
+        q->attribute_lengths[i] = strlen(s);
+        q->maybe_null[i] = 0;
+        switch (*s)
+        {
+        case 'p':
+            q->types[i] = p->type;
+            q->values[i] = NULL;
+            q->lengths[i] = 0;
+            q->maybe_null[i] = 1;
+            pooled = i;
+            break;
+        case 'i':
+            q->types[i] = INT_RESULT;
+            q->integers[i] = strtoll(s + 2, NULL, 10);
+            q->values[i] = (char *) &q->integers[i];
+            q->lengths[i] = sizeof(long long);
+            break;
+        case 'r':
+            q->types[i] = REAL_RESULT;
+            q->reals[i] = strtod(s + 2, NULL);
+            q->values[i] = (char *) &q->reals[i];
+            q->lengths[i] = sizeof(double);
+            break;
+        case 'b':
+            q->types[i] = STRING_RESULT;
+            q->values[i] = bloom;
+            q->lengths[i] = bloom_length;
+            break;
+        case 'n':
+            q->types[i] = STRING_RESULT;
+            q->values[i] = (char *) network_list(strtoul(s + 2, NULL, 10));
+            q->lengths[i] = strlen(q->values[i]);
+            break;
+        default:
+            q->types[i] = STRING_RESULT;
+            q->values[i] = *s == 'l' ? lpm_path : *s == 'P' ? psl_path : (char *) s + 2;
+            q->lengths[i] = strlen(q->values[i]);
+            break;
+        }
+    }
+    q->args.arg_count = i;
+
+    q->message[0] = '\0';
+    if (((init_fn) c->init)(&q->initid, &q->args, q->message))
+        return -1;
+
+    q->is_null = q->error = 0;
+    q->value = NULL;
+    q->length = 0;
+    if (c->clear)
+        ((clear_fn) c->clear)(&q->initid, &q->is_null, &q->error);
+    for (pass = 0; pass < (c->passes ? c->passes : 1); pass++)
+    {
+        for (i = first; i < first + count; i++)
+        {
+            if (pooled >= 0)
+            {
+                q->values[pooled] = p->values[i];
+                q->lengths[pooled] = p->lengths[i];
+            }
+            if (c->add)
+                ((add_fn) c->add)(&q->initid, &q->args, &q->is_null, &q->error);
+            else if (c->type == STRING_RESULT)
+            {
+                q->is_null = 0;
+                q->value = ((string_fn) c->func)(&q->initid, &q->args, q->result, &q->length,
+                        &q->is_null, &q->error);
+            }
+            else
+            {
+                q->is_null = 0;
+                q->integer = ((int_fn) c->func)(&q->initid, &q->args, &q->is_null, &q->error);
+            }
+        }
+    }
+    if (c->add && c->type == STRING_RESULT)
+        q->value = ((string_fn) c->func)(&q->initid, &q->args, q->result, &q->length, &q->is_null, &q->error);
+    else if (c->add)
+        q->integer = ((int_fn) c->func)(&q->initid, &q->args, &q->is_null, &q->error);
+    return 0;
+}
+
+static void query_end(bench_query *q, const bench_case *c)
+{
+    if (c->deinit)
+        ((deinit_fn) c->deinit)(&q->initid);
+}
+
+/**
+ * Run a query of a string function for a value of a workload.
+ *
+ * @return the result, NULL if it is NULL
+ */
+static char *query_value(const bench_case *c, uint first, uint count, unsigned long *length)
+{
+    bench_query q;
+    char *value = NULL;
+
+    if (query_run(&q, c, first, count))
+        die(q.message);
+    if (!q.is_null && q.value)
+    {
+        if (!(value = malloc(q.length + 1)))
+            die("out of memory");
+        memcpy(value, q.value, q.length);
+        value[q.length] = '\0';
+        *length = q.length;
+    }
+    query_end(&q, c);
+    return value;
+}
+
+static void make_pools(void)
+{
+    static const bench_case sketch = { "inet6_approx_sketch", "", STRING_AGGREGATE(inet6_approx_sketch),
+        POOL_MIXED, { "p" } };
+    static const bench_case filter = { "inet6_bloom_build", "", STRING_AGGREGATE(inet6_bloom_build),
+        POOL_MIXED, { "p", "i:1000000", "r:0.01" } };
+    static const bench_case punycode = { "idna_to_ascii", "", STRING(idna_to_ascii),
+        POOL_UNICODE_HOST, { "p" } };
+    char temp[INET6_ADDRSTRLEN + 8], host[256];
+    unsigned char bytes[16];
+    uint i, first, length;
+
+    for (i = 1; i < POOLS; i++)
+    {
+        pools[i].type = STRING_RESULT;
+        if (!(pools[i].values = calloc(rows, sizeof(char *)))
+                || !(pools[i].lengths = calloc(rows, sizeof(unsigned long))))
+            die("out of memory");
+    }
+    pools[POOL_PREFIX].type = INT_RESULT;
+
+    for (i = 0; i < rows; i++)
+    {
+        long long prefix = random64() % 129;
+        const char *tld = tlds[random64() % (sizeof(tlds) / sizeof(*tlds))];
+
+        pool_set(&pools[POOL_IPV4], i, temp, random_ipv4(temp));
+
+        random_bytes(bytes, sizeof(bytes));
+        sprintf(temp, "%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x:%02x%02x",
+                bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5], bytes[6], bytes[7],
+                bytes[8], bytes[9], bytes[10], bytes[11], bytes[12], bytes[13], bytes[14], bytes[15]);
+        pool_set(&pools[POOL_IPV6], i, temp, strlen(temp));
+
+        pool_set(&pools[POOL_IPV6_COMPRESSED], i, temp, random_compressed(temp));
+        pool_set(&pools[POOL_MIXED], i, temp, i & 1 ? random_ipv4(temp) : random_compressed(temp));
+        pool_set(&pools[POOL_INVALID], i, temp, random_invalid(temp));
+        pool_set(&pools[POOL_BINARY], i, bytes, i & 1 ? 4 : 16);
+        pool_set(&pools[POOL_BINARY_INVALID], i, bytes, 5 + random64() % 11);
+        pool_set(&pools[POOL_PREFIX], i, &prefix, sizeof(prefix));
+
+        length = i & 1 ? random_ipv4(temp) : random_compressed(temp);
+        length += sprintf(temp + length, "/%u", (uint) (i & 1 ? 8 + random64() % 25 : 16 + random64() % 113));
+        pool_set(&pools[POOL_CIDR], i, temp, length);
+
+        pool_set(&pools[POOL_ASCII_HOST], i, host, sprintf(host, "www%u.example%u.%s",
+                (uint) (random64() % 100), i, tld));
+        pool_set(&pools[POOL_UNICODE_HOST], i, host, sprintf(host, "%s%u.example.%s",
+                labels[random64() % (sizeof(labels) / sizeof(*labels))], i, tld));
+    }
+
+    // the unicode host names the way they are stored
+    for (i = 0; i < rows; i++)
+    {
+        if (!(pools[POOL_PUNYCODE_HOST].values[i] = query_value(&punycode, i, 1,
+                &pools[POOL_PUNYCODE_HOST].lengths[i])))
+            die("could not convert the host names, is nameprep working?");
+    }
+
+    // sketches of runs of the mixed pool of random lengths
+    for (i = 0; i < rows; i++)
+    {
+        first = random64() % rows;
+        pools[POOL_SKETCH].values[i] = query_value(&sketch, first, 1 + random64() % (rows - first),
+                &pools[POOL_SKETCH].lengths[i]);
+    }
+
+    bloom = query_value(&filter, 0, rows, &bloom_length);
+}
+
+static uint load_baseline(const char *path, bench_baseline *baseline)
+{
+    char line[512];
+    uint count = 0;
+    FILE *f;
+
+    if (!(f = fopen(path, "r")))
+    {
+        perror(path);
+        exit(1);
+    }
+    while (count < MAX_CASES && fgets(line, sizeof(line), f))
+    {
+        if (line[0] != '#' && sscanf(line, "%127s %*u %lf", baseline[count].name, &baseline[count].ns_per_row) == 2)
+            count++;
+    }
+    fclose(f);
+    return count;
+}
+
+/**
+ * Run a workload for at least min_time nanoseconds and print its results.
+ *
+ * @return the change against the baseline in percent, 0 without one
+ */
+static double run(const bench_case *c, double min_time, const bench_baseline *baseline, uint baselines)
+{
+    char name[128];
+    bench_query q;
+    unsigned long long queries = 0, allocated;
+    double start, elapsed, ns_per_row, change = 0;
+    uint i;
+
+    snprintf(name, sizeof(name), "%s/%s", c->udf, c->workload);
+
+    // once to warm up, and to see that it takes its arguments
+    if (query_run(&q, c, 0, c->pool ? rows : 1))
+    {
+        fprintf(stderr, "udf_bench: %s: %s\n", name, q.message);
+        return 0;
+    }
+    query_end(&q, c);
+
+    allocated = allocations;
+    start = now();
+    do
+    {
+        query_run(&q, c, 0, c->pool ? rows : 1);
+        query_end(&q, c);
+        queries++;
+    } while ((elapsed = now() - start) < min_time);
+
+    queries *= c->pool ? (unsigned long long) rows * (c->passes ? c->passes : 1) : 1;
+    ns_per_row = elapsed / queries;
+    printf("%s\t%llu\t%.1f\t%.0f\t%.3f", name, queries, ns_per_row, 1e9 / ns_per_row,
+            (double) (allocations - allocated) / queries);
+
+    if (baseline)
+    {
+        for (i = 0; i < baselines && strcmp(baseline[i].name, name); i++)
+            ;
+        if (i < baselines)
+        {
+            change = (ns_per_row / baseline[i].ns_per_row - 1) * 100;
+            printf("\t%.1f\t%+.1f%%", baseline[i].ns_per_row, change);
+        }
+        else
+            printf("\t-\t-");
+    }
+    printf("\n");
+    fflush(stdout);
+    return change;
+}
+
+int main(int argc, char **argv)
+{
+    static bench_baseline baseline[MAX_CASES];
+    const char *filter = NULL, *compare = NULL;
+    double min_time = 200e6, limit = 0, change;
+    uint i, baselines = 0, slower = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:f:c:r:l:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            rows = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            min_time = strtod(optarg, NULL) * 1e6;
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'c':
+            compare = optarg;
+            break;
+        case 'r':
+            limit = strtod(optarg, NULL);
+            break;
+        case 'l':
+            lpm_path = optarg;
+            break;
+        case 'p':
+            psl_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: udf_bench [-n rows] [-t milliseconds] [-f filter] [-c baseline [-r percent]]\n"
+                    "                 [-l table.lpm] [-p list.psl]\n");
+            return 2;
+        }
+    }
+    if (rows < 1)
+        die("need at least one row");
+    if (compare)
+        baselines = load_baseline(compare, baseline);
+
+    make_pools();
+
+    printf("# workload\trows\tns_per_row\trows_per_s\tallocs_per_row%s\n",
+            compare ? "\tbaseline_ns_per_row\tchange" : "");
+    for (i = 0; i < sizeof(cases) / sizeof(*cases); i++)
+    {
+        const bench_case *c = &cases[i];
+        char name[128];
+        uint j;
+
+        snprintf(name, sizeof(name), "%s/%s", c->udf, c->workload);
+        if (filter && !strstr(name, filter))
+            continue;
+        for (j = 0; j < MAX_ARGS && c->spec[j]; j++)
+        {
+            if ((*c->spec[j] == 'l' && !lpm_path) || (*c->spec[j] == 'P' && !psl_path))
+                break;
+        }
+        if (j < MAX_ARGS && c->spec[j])
+            continue;
+
+        change = run(c, min_time, compare ? baseline : NULL, baselines);
+        if (limit > 0 && change > limit)
+            slower++;
+    }
+
+    if (slower)
+    {
+        fprintf(stderr, "udf_bench: %u workloads slower than the baseline by more than %g%%\n", slower, limit);
+        return 1;
+    }
+    return 0;
+}
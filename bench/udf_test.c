@@ -0,0 +1,514 @@
+/**
+ * udf_test.c
+ *
+ * Check the functions of mysql_udf_ipv6.c without a server. The address
+ * parser and formatter are compared with inet_pton(3) and inet_ntop(3) on
+ * edge cases and on random input, which is made by formatting random
+ * addresses and then changing a few characters of them. Other cases check
+ * behaviour that broke before, like which of two equal networks wins in a
+ * table made with inet6_lpm_compile, or merging sketches of different
+ * precisions.
+ *
+ * Usage: udf_test [-n rounds] [-s seed] [-l inet6_lpm_compile]
+ *
+ *   -n  random addresses to try, 1000000 by default
+ *   -s  seed of the random input, to repeat a failed run
+ *   -l  path of inet6_lpm_compile, ./inet6_lpm_compile by default
+ *
+ * Failures are written to stderr, and make the exit status 1.
+ *
+ * Copyright (c) 2011 WatchMouse
+ *
+ * Licensed under the EUPL, Version 1.1 or – as soon they will be approved
+ * by the European Commission - subsequent versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the Licence. You may
+ * obtain a copy of the Licence at:
+ *
+ *   http://ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+// tests the internals of the UDFs as well
+#include "../mysql_udf_ipv6.c"
+
+static unsigned long failures;
+static uint64_t seed = 88172645463325252ULL;
+
+static void fail(const char *test, const char *what, const char *input, unsigned long length)
+{
+    unsigned long i;
+
+    fprintf(stderr, "udf_test: %s: %s for \"", test, what);
+    for (i = 0; i < length; i++)
+    {
+        if (isprint((unsigned char) input[i]))
+            fputc(input[i], stderr);
+        else
+            fprintf(stderr, "\\x%02x", (unsigned char) input[i]);
+    }
+    fprintf(stderr, "\"\n");
+    failures++;
+}
+
+// xorshift64, so that a seed repeats a run
+static uint64_t random64(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+/**
+ * Parse the length bytes at src with inet6_parse() and inet6_parse_any(),
+ * and compare with what inet_pton() makes of them.
+ */
+static void check_parse(const char *src, unsigned long length)
+{
+    char text[64], buf[64], expect[INET6_ADDRLEN], got[INET6_ADDRLEN];
+    uint want = 0, n;
+
+    if (length >= sizeof(text) - 1)
+        return;
+    memcpy(text, src, length);
+    text[length] = '\0';
+    if (strlen(text) == length)
+    {
+        if (inet_pton(AF_INET, text, expect) == 1)
+            want = INET_ADDRLEN;
+        else if (inet_pton(AF_INET6, text, expect) == 1)
+            want = INET6_ADDRLEN;
+    }
+
+    // digits after the end must not be read
+    memcpy(buf, src, length);
+    strcpy(buf + length, "1:1");
+
+    if ((n = inet6_parse(buf, length, (unsigned char *) got)) != want)
+        fail("inet6_parse", want ? "rejected" : "accepted", src, length);
+    else if (n && memcmp(got, expect, n))
+        fail("inet6_parse", "wrong address", src, length);
+
+    // binary addresses are taken as they are
+    if (!want && (length == INET_ADDRLEN || length == INET6_ADDRLEN))
+    {
+        want = length;
+        memcpy(expect, src, length);
+    }
+    if ((n = inet6_parse_any(buf, length, got)) != want)
+        fail("inet6_parse_any", want ? "rejected" : "accepted", src, length);
+    else if (n && memcmp(got, expect, n))
+        fail("inet6_parse_any", "wrong address", src, length);
+}
+
+/**
+ * Format the binary address at src with inet6_format() and compare with
+ * inet_ntop().
+ */
+static void check_format(const unsigned char *src, uint length)
+{
+    char expect[INET6_ADDRSTRLEN], got[INET6_FORMAT_BUFLEN];
+    uint n;
+
+    if (!inet_ntop(length == INET_ADDRLEN ? AF_INET : AF_INET6, src, expect, sizeof(expect)))
+    {
+        fail("inet6_format", "inet_ntop failed", (const char *) src, length);
+        return;
+    }
+    n = inet6_format(src, length, got);
+    if (n != strlen(expect) || memcmp(got, expect, n))
+        fail("inet6_format", "wrong string", expect, strlen(expect));
+
+    // and back again
+    check_parse(expect, strlen(expect));
+}
+
+// random address, with runs of zero groups and embedded IPv4 addresses often enough
+static uint random_address(unsigned char *dst)
+{
+    static const unsigned char prefixes[][12] = {
+        { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff },
+        { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+        { 0, 0x64, 0xff, 0x9b, 0, 0, 0, 0, 0, 0, 0, 0 },
+        { 0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    };
+    uint64_t r = random64(), zeros = random64();
+    uint i;
+
+    for (i = 0; i < INET6_ADDRLEN; i += 8)
+    {
+        uint64_t w = random64();
+
+        memcpy(dst + i, &w, 8);
+    }
+
+    switch (r & 7)
+    {
+    case 0:
+        return INET_ADDRLEN;
+    case 1:
+        memcpy(dst, prefixes[(r >> 3) & 3], sizeof(prefixes[0]));
+        // small numbers too, like ::1
+        if (r & 0x20)
+            memset(dst + 12, 0, 3);
+        break;
+    default:
+        // each group zero with a chance of 1 in 2, 4 or 8
+        for (i = 0; i < 8; i++, zeros >>= 3)
+        {
+            if ((zeros & 7) < (r >> 3 & 3) + 1 || (r & 0x40 && (zeros & 7) < 4))
+                dst[2 * i] = dst[2 * i + 1] = 0;
+            // short groups, to leave out leading zeros
+            else if (zeros & 1)
+                dst[2 * i] = 0;
+        }
+    }
+    return INET6_ADDRLEN;
+}
+
+// change one character, drop one or insert one
+static unsigned long mutate(char *s, unsigned long length, unsigned long size)
+{
+    static const char alphabet[] = "0123456789abcdefABCDEFgx:::...%/ \t";
+    uint64_t r = random64();
+    unsigned long at = length ? (r >> 8) % length : 0;
+    char c = alphabet[(r >> 40) % (sizeof(alphabet) - 1)];
+
+    switch (r & 3)
+    {
+    case 0:
+        if (length)
+            s[at] = c;
+        break;
+    case 1:
+        if (length)
+        {
+            memmove(s + at, s + at + 1, length - at - 1);
+            length--;
+        }
+        break;
+    default:
+        if (length + 1 < size)
+        {
+            at = length ? (r >> 8) % (length + 1) : 0;
+            memmove(s + at + 1, s + at, length - at);
+            s[at] = c;
+            length++;
+        }
+    }
+    return length;
+}
+
+static void test_address(unsigned long rounds)
+{
+    static const char *const edge[] = {
+        "", ":", "::", ":::", "::::", "::1", "1::", "1:", ":1", "::1:", ":1::", "1::2::3", "1:::2",
+        "0:0:0:0:0:0:0:0", "0:0:0:0:0:0:0:0:0", "1:2:3:4:5:6:7", "1:2:3:4:5:6:7:8", "1:2:3:4:5:6:7:8:9",
+        "1:2:3:4:5:6:7::", "::2:3:4:5:6:7:8", "1::3:4:5:6:7:8", "1:2:3:4:5:6:7:8::", "::1:2:3:4:5:6:7:8",
+        "00000::", "0000::", "fffff::", "ffff::", "FFFF::", "ffff::g", "12345::",
+        "1.2.3.4", "0.0.0.0", "255.255.255.255", "256.0.0.0", "1.2.3", "1.2.3.4.5", "1.2.3.", ".1.2.3",
+        "1..2.3", "01.2.3.4", "1.2.3.04", "1.2.3.4a", "0x1.2.3.4", "1.2.3.4 ", " 1.2.3.4", "1.2.3.4/24",
+        "::1.2.3.4", "::ffff:1.2.3.4", "::ffff:1.2.3.4:5", "1:2:3:4:5:6:1.2.3.4", "1:2:3:4:5:6:7:1.2.3.4",
+        "1:2:3:4:5:1.2.3.4", "1::1.2.3.4", "1:2:3:4:5:6::1.2.3.4", "::1.2.3", "::1.2.3.4.5", "::01.2.3.4",
+        "::256.1.2.3", "1.2.3.4::", "1.2.3.4:1::", "::ffff:1.2.3.4%eth0", "64:ff9b::192.0.2.1",
+        "fe80::1%eth0", "fe80::1%1", "fe80::%eth0", "%eth0", "fe80::1%",
+        "2001:db8::/32", "2001:db8:::1", ":2001:db8::1", "2001:db8::1:", "2001:db8::1::",
+        "2001:0db8:0000:0000:0000:ff00:0042:8329", "ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255",
+        "ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.2555", "0000:0000:0000:0000:0000:0000:0000:0000:",
+        "\x01\x02\x03\x04", "\xff\xff\xff\xff", "1234", "12345", "0123456789abcdef", "0123456789abcdef0",
+        "1:2:", "::ffff:", "::ffff:1.", "1::2:", "\t::1", "::1\n", "::1 ",
+    };
+    unsigned char address[INET6_ADDRLEN];
+    char text[64];
+    unsigned long i, length;
+    uint n, k;
+
+    for (i = 0; i < sizeof(edge) / sizeof(*edge); i++)
+        check_parse(edge[i], strlen(edge[i]));
+    // nul bytes within the length
+    check_parse("\0\0\0\0", 4);
+    check_parse("::1\0", 4);
+    check_parse("1.2.3.4\0", 8);
+
+    for (i = 0; i < rounds; i++)
+    {
+        n = random_address(address);
+        check_format(address, n);
+
+        inet_ntop(n == INET_ADDRLEN ? AF_INET : AF_INET6, address, text, sizeof(text));
+        length = strlen(text);
+        for (k = random64() & 3; k; k--)
+            length = mutate(text, length, sizeof(text));
+        check_parse(text, length);
+    }
+}
+
+/**
+ * Addresses in the forms of a policy become the IPv4 address they embed,
+ * others stay as they are, like hosts within a 6to4 /48.
+ */
+static void test_canonical(void)
+{
+    static const char *const cases[][3] = {
+        { "::ffff:1.2.3.4", "mapped", "1.2.3.4" },
+        { "::ffff:1.2.3.4", "nat64", "::ffff:1.2.3.4" },
+        { "::1.2.3.4", "compat", "1.2.3.4" },
+        { "::1", "all", "::1" },
+        { "64:ff9b::1.2.3.4", "all", "1.2.3.4" },
+        { "2002:102:304::", "6to4", "1.2.3.4" },
+        { "2002:102:304::1", "6to4", "2002:102:304::1" },
+        { "2002:102:304::2", "all", "2002:102:304::2" },
+        { "2002:102:304:1::", "all", "2002:102:304:1::" },
+        { "2002:102:304::102:304", "all", "2002:102:304::102:304" },
+    };
+    unsigned char address[INET6_ADDRLEN];
+    char text[INET6_FORMAT_BUFLEN];
+    uint i, length;
+
+    for (i = 0; i < sizeof(cases) / sizeof(*cases); i++)
+    {
+        length = inet6_parse(cases[i][0], strlen(cases[i][0]), address);
+        length = inet6_canonical(address, length,
+                inet6_canonical_policy(cases[i][1], strlen(cases[i][1])));
+        length = inet6_format(address, length, text);
+        if (strlen(cases[i][2]) != length || memcmp(text, cases[i][2], length))
+        {
+            fprintf(stderr, "udf_test: inet6_canonicalize: %s with %s gives %.*s, expected %s\n",
+                    cases[i][0], cases[i][1], (int) length, text, cases[i][2]);
+            failures++;
+        }
+    }
+}
+
+// value of the longest network in m holding address, "" for none
+static const char *match_value(const inet6_match_list *m, const uint32_t *offsets, const char *strings,
+        const char *address)
+{
+    static char value[64];
+    char temp[INET6_ADDRLEN];
+    uint32_t i;
+
+    if (!(i = inet6_match_lookup(m, temp, inet6_parse(address, strlen(address), (unsigned char *) temp))))
+        return "";
+    if (!offsets)
+        sprintf(value, "%u", i);
+    else
+        sprintf(value, "%.*s", (int) (offsets[i] - offsets[i - 1]), strings + offsets[i - 1]);
+    return value;
+}
+
+static void check_match(const char *test, const inet6_match_list *m, const uint32_t *offsets, const char *strings,
+        const char *address, const char *expect)
+{
+    const char *got = match_value(m, offsets, strings, address);
+
+    if (strcmp(got, expect))
+    {
+        fprintf(stderr, "udf_test: %s: %s for %s, expected %s\n", test, *got ? got : "no match", address, expect);
+        failures++;
+    }
+}
+
+/**
+ * Where the same network is listed twice, the first one wins, also when
+ * its value was seen before the value of the second one.
+ */
+static void test_duplicates(const char *compiler)
+{
+    static const char csv[] =
+        "1.0.0.0/8,X\n"
+        "2.0.0.0/8,Y\n"
+        "2.0.0.0/8,X\n"
+        "3.0.0.0,3.0.0.255,Y\n"
+        "3.0.0.0/24,X\n"
+        "2001:db8::/32,Y\n"
+        "2001:db8::/32,X\n"
+        "::/0,Y\n"
+        "::/0,X\n";
+    static const char list[] = "10.0.0.0/8, 10.0.0.0/8, ::/0, ::/0, 2001:db8::/32, 2001:db8::/32";
+    char message[MYSQL_ERRMSG_SIZE], path[64], command[256];
+    inet6_match_list *m;
+    inet6_lpm_table *t;
+    FILE *f;
+
+    // positions in a list
+    if (!(m = inet6_match_compile(list, strlen(list), message, "udf_test")))
+    {
+        fprintf(stderr, "udf_test: inet6_match_compile: %s\n", message);
+        failures++;
+        return;
+    }
+    check_match("inet6_match_index", m, NULL, NULL, "10.1.2.3", "1");
+    check_match("inet6_match_index", m, NULL, NULL, "2001:db8::1", "5");
+    check_match("inet6_match_index", m, NULL, NULL, "192.0.2.1", "3");
+    check_match("inet6_match_index", m, NULL, NULL, "2001:db9::1", "3");
+    inet6_match_free(m);
+
+    // values in a compiled table
+    sprintf(path, "/tmp/udf_test.%ld.csv", (long) getpid());
+    if (!(f = fopen(path, "w")) || fputs(csv, f) == EOF || fclose(f))
+    {
+        perror(path);
+        failures++;
+        return;
+    }
+    snprintf(command, sizeof(command), "%s %s %s.lpm 2>/dev/null", compiler, path, path);
+    if (system(command))
+    {
+        fprintf(stderr, "udf_test: %s failed\n", command);
+        failures++;
+        unlink(path);
+        return;
+    }
+    unlink(path);
+    strcat(path, ".lpm");
+    if (!(t = inet6_lpm_acquire(path, message)))
+    {
+        fprintf(stderr, "udf_test: %s\n", message);
+        failures++;
+        unlink(path);
+        return;
+    }
+    check_match("inet6_lpm_compile", &t->list, t->offsets, t->strings, "1.2.3.4", "X");
+    check_match("inet6_lpm_compile", &t->list, t->offsets, t->strings, "2.1.2.3", "Y");
+    check_match("inet6_lpm_compile", &t->list, t->offsets, t->strings, "3.0.0.1", "Y");
+    check_match("inet6_lpm_compile", &t->list, t->offsets, t->strings, "2001:db8::1", "Y");
+    check_match("inet6_lpm_compile", &t->list, t->offsets, t->strings, "192.0.2.1", "Y");
+    check_match("inet6_lpm_compile", &t->list, t->offsets, t->strings, "2001:db9::1", "Y");
+    inet6_lpm_release(t);
+    unlink(path);
+}
+
+// sketch of count addresses starting at first, at precision p
+static unsigned long make_sketch(uint p, uint32_t first, uint32_t count, unsigned char *dst)
+{
+    inet6_hll *h = calloc(1, sizeof(*h));
+    unsigned long length;
+    uint32_t i;
+
+    h->precision = h->configured = p;
+    for (i = first; i < first + count; i++)
+    {
+        unsigned char address[INET_ADDRLEN] = { 10, i >> 16, i >> 8, i };
+
+        inet6_hll_add_hash(h, inet6_hll_hash((const char *) address, sizeof(address)));
+    }
+    length = inet6_hll_serialize(h);
+    memcpy(dst, h->result, length);
+    inet6_hll_free(h);
+    return length;
+}
+
+/**
+ * Merge two sketches as inet6_approx_merge() does, and count the result as
+ * inet6_approx_count() does.
+ */
+static void check_sketch_merge(const char *test, const unsigned char *a, unsigned long a_length,
+        const unsigned char *b, unsigned long b_length, uint expect_precision, long long low, long long high)
+{
+    inet6_hll *h = calloc(1, sizeof(*h));
+    unsigned long length;
+    long long count = -1, merged = -1;
+    uint p;
+
+    if (inet6_hll_merge(h, a, a_length) || inet6_hll_merge(h, b, b_length) || !(length = inet6_hll_serialize(h)))
+    {
+        fprintf(stderr, "udf_test: %s: merge failed\n", test);
+        failures++;
+    }
+    else if ((p = inet6_hll_valid(h->result, length)) != expect_precision)
+    {
+        fprintf(stderr, "udf_test: %s: merged sketch of %lu bytes has precision %u, expected %u\n",
+                test, length, p, expect_precision);
+        failures++;
+    }
+    else
+    {
+        merged = llround(inet6_hll_estimate(h));
+        count = inet6_approx_estimate((const char *) h->result, length);
+    }
+
+    // counted from the bytes, as in memory
+    if (count != merged)
+    {
+        fprintf(stderr, "udf_test: %s: serialized sketch counts %lld, in memory %lld\n", test, count, merged);
+        failures++;
+    }
+    else if (count >= 0 && (count < low || count > high))
+    {
+        fprintf(stderr, "udf_test: %s: merged sketch counts %lld, expected %lld to %lld\n",
+                test, count, low, high);
+        failures++;
+    }
+    inet6_hll_free(h);
+}
+
+/**
+ * Sketches merged at a lower precision, where a sparse sketch has more
+ * registers than that precision allows and must become dense.
+ */
+static void test_sketches(void)
+{
+    static unsigned char big[HLL_MAX_SKETCH], empty[HLL_MAX_SKETCH], small[HLL_MAX_SKETCH];
+    unsigned long big_length = make_sketch(18, 0, 1000, big), empty_length = make_sketch(4, 0, 0, empty);
+    unsigned long small_length = make_sketch(4, 1000, 3, small);
+
+    // within 3 standard errors at precision 4
+    check_sketch_merge("inet6_approx_merge", big, big_length, empty, empty_length, 4, 220, 1780);
+    check_sketch_merge("inet6_approx_merge", empty, empty_length, big, big_length, 4, 220, 1780);
+    check_sketch_merge("inet6_approx_merge", big, big_length, small, small_length, 4, 220, 1780);
+    check_sketch_merge("inet6_approx_merge", small, small_length, small, small_length, 4, 3, 3);
+
+    // entries out of order, which would count one register twice
+    memcpy(small + HLL_HEADER + 4, small + HLL_HEADER, 4);
+    if (inet6_approx_estimate((const char *) small, small_length) != -1)
+    {
+        fprintf(stderr, "udf_test: inet6_approx_count: sketch with a register twice is counted\n");
+        failures++;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *compiler = "./inet6_lpm_compile";
+    unsigned long rounds = 1000000;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:s:l:")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            rounds = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10) | 1;
+            break;
+        case 'l':
+            compiler = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: udf_test [-n rounds] [-s seed] [-l inet6_lpm_compile]\n");
+            return 2;
+        }
+    }
+
+    test_address(rounds);
+    test_canonical();
+    test_duplicates(compiler);
+    test_sketches();
+
+    if (failures)
+    {
+        fprintf(stderr, "udf_test: %lu failures\n", failures);
+        return 1;
+    }
+    fprintf(stderr, "udf_test: all passed\n");
+    return 0;
+}
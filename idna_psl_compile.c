@@ -0,0 +1,238 @@
+/**
+ * idna_psl_compile.c
+ *
+ * Compile the Public Suffix List into a file for the idna_public_suffix() and
+ * idna_registrable_domain() MySQL functions.
+ *
+ * Usage: idna_psl_compile public_suffix_list.dat output.psl
+ *
+ * The list is available from https://publicsuffix.org/list/ and packaged by
+ * most distributions, as /usr/share/publicsuffix/public_suffix_list.dat on
+ * Debian. Each rule is converted to its ASCII compatible form, so that
+ * internationalised and punycoded host names find the same rules.
+ *
+ * The list is written to a temporary file that is then renamed over the
+ * output, so that running queries keep using the list they started with.
+ *
+ * Copyright (c) 2011 WatchMouse
+ *
+ * Licensed under the EUPL, Version 1.1 or – as soon they will be approved
+ * by the European Commission - subsequent versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the Licence. You may
+ * obtain a copy of the Licence at:
+ *
+ *   http://ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+// shares the conversion to ASCII and the file format with the UDFs
+#include "mysql_udf_idna.c"
+
+#include <ctype.h>
+#include <errno.h>
+
+typedef struct
+{
+    idna_psl_node *nodes;
+    uint32_t *buckets;
+    char *strings;
+    uint32_t nodes_used, nodes_size, mask, strings_used, strings_size;
+} psl_builder;
+
+static void die(const char *file, unsigned long line, const char *what)
+{
+    if (line)
+        fprintf(stderr, "idna_psl_compile: %s:%lu: %s\n", file, line, what);
+    else
+        fprintf(stderr, "idna_psl_compile: %s: %s\n", file, what);
+    exit(1);
+}
+
+static void *xrealloc(void *p, size_t size)
+{
+    if (!(p = realloc(p, size)))
+        die("realloc", 0, strerror(errno));
+    return p;
+}
+
+/**
+ * Hash all nodes into size buckets. Chains are linked in order of the nodes,
+ * as the UDFs check to be sure that lookups end.
+ */
+static void rehash(psl_builder *b, uint32_t size)
+{
+    uint32_t i, *bucket;
+
+    b->buckets = xrealloc(b->buckets, size * sizeof(*b->buckets));
+    memset(b->buckets, 0, size * sizeof(*b->buckets));
+    b->mask = size - 1;
+    for (i = b->nodes_used; i > 0; i--)
+    {
+        idna_psl_node *n = &b->nodes[i - 1];
+
+        bucket = &b->buckets[idna_psl_hash(n->parent, b->strings + n->label, n->length) & b->mask];
+        n->next = *bucket;
+        *bucket = i;
+    }
+}
+
+// child of parent with a label, added if it is new
+static uint32_t add_child(psl_builder *b, uint32_t parent, const char *label, size_t length)
+{
+    uint32_t i, *bucket;
+    idna_psl_node *n;
+
+    if ((i = idna_psl_child(b->buckets, b->mask, b->nodes, b->strings, parent, label, length)))
+        return i;
+
+    if (b->nodes_used == b->nodes_size)
+    {
+        b->nodes_size *= 2;
+        b->nodes = xrealloc(b->nodes, b->nodes_size * sizeof(*b->nodes));
+    }
+    if (b->strings_size - b->strings_used < length)
+    {
+        b->strings_size = b->strings_size * 2 + length;
+        b->strings = xrealloc(b->strings, b->strings_size);
+    }
+
+    i = b->nodes_used++;
+    n = &b->nodes[i];
+    memset(n, 0, sizeof(*n));
+    n->parent = parent;
+    n->label = b->strings_used;
+    n->length = (uint8_t) length;
+    memcpy(b->strings + b->strings_used, label, length);
+    b->strings_used += length;
+
+    // keep the hash table at most half full
+    if (b->nodes_used * 2 > b->mask + 1)
+        rehash(b, (b->mask + 1) * 2);
+    else
+    {
+        bucket = &b->buckets[idna_psl_hash(parent, label, length) & b->mask];
+        n->next = *bucket;
+        *bucket = i + 1;
+    }
+    return i;
+}
+
+static void write_all(FILE *f, const void *p, size_t size, const char *path)
+{
+    if (size && fwrite(p, size, 1, f) != 1)
+        die(path, 0, strerror(errno));
+}
+
+int main(int argc, char **argv)
+{
+    psl_builder b;
+    idna_psl_header h;
+    char *line = NULL, *temp;
+    size_t size = 0;
+    ssize_t n;
+    unsigned long lineno = 0, rules = 0;
+    FILE *in, *out;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: idna_psl_compile public_suffix_list.dat output.psl\n");
+        return 2;
+    }
+    if (!(in = fopen(argv[1], "r")))
+        die(argv[1], 0, strerror(errno));
+
+    memset(&b, 0, sizeof(b));
+    b.nodes_size = 1024;
+    b.nodes = xrealloc(NULL, b.nodes_size * sizeof(*b.nodes));
+    rehash(&b, 2048);
+
+    // the root
+    memset(&b.nodes[0], 0, sizeof(b.nodes[0]));
+    b.nodes_used = 1;
+
+    while ((n = getline(&line, &size, in)) >= 0)
+    {
+        char *p = line, *end, ascii[MAX_HOSTNAME_LEN];
+        long length, i, stop;
+        uint32_t node = 0;
+        int flag = PSL_RULE;
+
+        lineno++;
+
+        // a rule is the first word on a line
+        while (*p && isspace((unsigned char) *p))
+            p++;
+        for (end = p; *end && !isspace((unsigned char) *end); end++)
+            ;
+        if (p == end || (end - p >= 2 && p[0] == '/' && p[1] == '/'))
+            continue;
+
+        if (*p == '!')
+        {
+            flag = PSL_EXCEPTION;
+            p++;
+        }
+        else if (end - p >= 2 && p[0] == '*' && p[1] == '.')
+        {
+            flag = PSL_WILDCARD;
+            p += 2;
+        }
+        if (memchr(p, '*', end - p))
+        {
+            fprintf(stderr, "idna_psl_compile: %s:%lu: skipping unsupported wildcard\n", argv[1], lineno);
+            continue;
+        }
+        if ((length = idna_encode(p, end - p, NULL, ascii)) <= 0 || ascii[length - 1] == '.')
+            die(argv[1], lineno, "invalid rule");
+
+        // labels from right to left, in lower case
+        for (i = 0; i < length; i++)
+            ascii[i] = (char) tolower((unsigned char) ascii[i]);
+        for (stop = length, i = length - 1; ; i--)
+        {
+            if (i >= 0 && ascii[i] != '.')
+                continue;
+            node = add_child(&b, node, ascii + i + 1, stop - i - 1);
+            if (i < 0)
+                break;
+            stop = i;
+        }
+        b.nodes[node].flags |= flag;
+        rules++;
+    }
+    if (ferror(in))
+        die(argv[1], 0, strerror(errno));
+    fclose(in);
+    free(line);
+
+    rehash(&b, b.mask + 1);
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, IDNA_PSL_MAGIC, sizeof(h.magic));
+    h.version = IDNA_PSL_VERSION;
+    h.buckets = b.mask + 1;
+    h.nodes = b.nodes_used;
+    h.strings = b.strings_used;
+
+    temp = xrealloc(NULL, strlen(argv[2]) + 32);
+    sprintf(temp, "%s.tmp.%ld", argv[2], (long) getpid());
+    if (!(out = fopen(temp, "w")))
+        die(temp, 0, strerror(errno));
+    write_all(out, &h, sizeof(h), temp);
+    write_all(out, b.buckets, (size_t) h.buckets * sizeof(uint32_t), temp);
+    write_all(out, b.nodes, (size_t) h.nodes * sizeof(idna_psl_node), temp);
+    write_all(out, b.strings, h.strings, temp);
+    if (fflush(out) || fsync(fileno(out)) || fclose(out))
+        die(temp, 0, strerror(errno));
+    if (rename(temp, argv[2]))
+        die(argv[2], 0, strerror(errno));
+
+    fprintf(stderr, "idna_psl_compile: %s: %lu rules, %u labels\n", argv[2], rules, h.nodes - 1);
+    return 0;
+}
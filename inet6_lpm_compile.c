@@ -0,0 +1,321 @@
+/**
+ * inet6_lpm_compile.c
+ *
+ * Compile a CSV file of networks and values into a longest prefix match
+ * table file for the inet6_lpm_lookup() MySQL function.
+ *
+ * Usage: inet6_lpm_compile input.csv output.lpm
+ *
+ * Each line of the input holds one of:
+ *
+ *   cidr,value             like 192.0.2.0/24,AS64496
+ *   start,end,value        like 192.0.2.0,192.0.2.255,AS64496
+ *   address,value          like 2001:db8::1,AS64496
+ *
+ * Values may be quoted with double quotes. Empty lines and lines starting
+ * with # are skipped. Where networks overlap, lookups return the value of the
+ * longest one; where the same network is listed twice, the first value wins.
+ *
+ * The table is written to a temporary file that is then renamed over the
+ * output, so that running queries keep using the table they started with.
+ *
+ * Copyright (c) 2009-2011 WatchMouse
+ *
+ * Licensed under the EUPL, Version 1.1 or – as soon they will be approved
+ * by the European Commission - subsequent versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the Licence. You may
+ * obtain a copy of the Licence at:
+ *
+ *   http://ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+// shares the parser and trie builder with the UDFs
+#include "mysql_udf_ipv6.c"
+
+#include <errno.h>
+
+typedef unsigned __int128 uint128;
+
+// distinct values, in order of first appearance
+typedef struct
+{
+    char *strings;
+    uint32_t *offsets;          // values + 1 of them
+    uint32_t *hash;             // open addressing, 1-based value or 0
+    uint32_t values, strings_used, strings_size, hash_size;
+} lpm_values;
+
+static void die(const char *file, unsigned long line, const char *what)
+{
+    if (line)
+        fprintf(stderr, "inet6_lpm_compile: %s:%lu: %s\n", file, line, what);
+    else
+        fprintf(stderr, "inet6_lpm_compile: %s: %s\n", file, what);
+    exit(1);
+}
+
+static void *xrealloc(void *p, size_t size)
+{
+    if (!(p = realloc(p, size)))
+        die("realloc", 0, strerror(errno));
+    return p;
+}
+
+static uint32_t hash_value(const char *s, uint32_t length)
+{
+    uint32_t h = 2166136261U;
+
+    while (length--)
+        h = (h ^ (unsigned char) *s++) * 16777619U;
+    return h;
+}
+
+/**
+ * 1-based index of value s, added if it is new.
+ */
+static uint32_t lpm_value(lpm_values *v, const char *s, uint32_t length)
+{
+    uint32_t i, *slot;
+
+    // keep the hash table at most half full
+    if (v->values * 2 >= v->hash_size)
+    {
+        uint32_t size = v->hash_size ? v->hash_size * 2 : 1024, *hash = calloc(size, sizeof(*hash));
+
+        if (!hash)
+            die("calloc", 0, strerror(errno));
+        for (i = 1; i <= v->values; i++)
+        {
+            slot = hash + (hash_value(v->strings + v->offsets[i - 1], v->offsets[i] - v->offsets[i - 1]) & (size - 1));
+            while (*slot)
+                slot = hash + ((slot - hash + 1) & (size - 1));
+            *slot = i;
+        }
+        free(v->hash);
+        v->hash = hash;
+        v->hash_size = size;
+        v->offsets = xrealloc(v->offsets, (size / 2 + 1) * sizeof(*v->offsets));
+        v->offsets[0] = 0;
+    }
+
+    for (slot = v->hash + (hash_value(s, length) & (v->hash_size - 1)); *slot;
+            slot = v->hash + ((slot - v->hash + 1) & (v->hash_size - 1)))
+    {
+        i = *slot;
+        if (v->offsets[i] - v->offsets[i - 1] == length && !memcmp(v->strings + v->offsets[i - 1], s, length))
+            return i;
+    }
+
+    if (v->strings_size - v->strings_used < length)
+    {
+        v->strings_size = v->strings_size * 2 + length;
+        v->strings = xrealloc(v->strings, v->strings_size);
+    }
+    memcpy(v->strings + v->strings_used, s, length);
+    v->strings_used += length;
+    v->offsets[++v->values] = v->strings_used;
+    *slot = v->values;
+    return v->values;
+}
+
+/**
+ * Parse an address into a 128-bit number, IPv4 in its IPv4-mapped form.
+ *
+ * @return 4 or 16 for the address family, 0 if invalid
+ */
+static uint parse_number(const char *s, unsigned long length, uint128 *n)
+{
+    char temp[INET6_ADDRLEN];
+    uint64_t w[2];
+    uint addrlen;
+
+    if (!(addrlen = inet6_parse(s, length, (unsigned char *) temp)))
+        return 0;
+    inet6_mapped_words(temp, addrlen, w);
+    *n = ((uint128) inet6_load64((unsigned char *) &w[0]) << 64) | inet6_load64((unsigned char *) &w[1]);
+    return addrlen;
+}
+
+static void add_network(inet6_match_builder *b, uint128 start, uint prefix, uint32_t value)
+{
+    unsigned char bytes[INET6_ADDRLEN];
+    uint64_t net[2];
+    int i;
+
+    for (i = INET6_ADDRLEN - 1; i >= 0; i--, start >>= 8)
+        bytes[i] = (unsigned char) start;
+    memcpy(net, bytes, sizeof(net));
+    if (inet6_match_add(b, net, prefix, value))
+        die("realloc", 0, strerror(errno));
+}
+
+/**
+ * Add the range start to end as the smallest list of networks covering it.
+ */
+static void add_range(inet6_match_builder *b, uint128 start, uint128 end, uint32_t value)
+{
+    uint bits;
+
+    for (;;)
+    {
+        // largest block aligned at start that does not pass end
+        for (bits = 0; bits < 128 && !((start >> bits) & 1); bits++)
+            ;
+        while (bits && (bits == 128 || start + (((uint128) 1 << bits) - 1) > end))
+            bits--;
+
+        add_network(b, start, 128 - bits, value);
+        if (start + (((uint128) 1 << bits) - 1) == end)
+            return;
+        start += (uint128) 1 << bits;
+    }
+}
+
+// trim white space and double quotes around a field
+static const char *trim(const char *p, const char **end)
+{
+    while (p < *end && isspace((unsigned char) *p))
+        p++;
+    while (*end > p && isspace((unsigned char) (*end)[-1]))
+        (*end)--;
+    if (*end - p >= 2 && *p == '"' && (*end)[-1] == '"')
+    {
+        p++;
+        (*end)--;
+    }
+    return p;
+}
+
+static void write_all(FILE *f, const void *p, size_t size, const char *path)
+{
+    if (size && fwrite(p, size, 1, f) != 1)
+        die(path, 0, strerror(errno));
+}
+
+int main(int argc, char **argv)
+{
+    inet6_match_builder b;
+    inet6_match_list m;
+    lpm_values v;
+    inet6_lpm_header h;
+    char *line = NULL, *temp;
+    size_t size = 0;
+    ssize_t n;
+    unsigned long lineno = 0;
+    FILE *in, *out;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: inet6_lpm_compile input.csv output.lpm\n");
+        return 2;
+    }
+    if (!(in = fopen(argv[1], "r")))
+        die(argv[1], 0, strerror(errno));
+
+    memset(&b, 0, sizeof(b));
+    memset(&v, 0, sizeof(v));
+
+    while ((n = getline(&line, &size, in)) >= 0)
+    {
+        const char *p = line, *end = line + n, *f1, *f2, *e1, *e2;
+        uint128 start, last;
+        uint64_t net[2];
+        uint fam1, fam2;
+        int prefix;
+
+        lineno++;
+        p = trim(p, &end);
+        if (p == end || *p == '#')
+            continue;
+        if (!(e1 = memchr(p, ',', end - p)))
+            die(argv[1], lineno, "expected network and value");
+        f1 = trim(p, &e1);
+
+        // cidr,value or address,value
+        if ((prefix = inet6_parse_cidr(f1, e1 - f1, net)) >= 0 && memchr(f1, '/', e1 - f1))
+        {
+            p = memchr(p, ',', end - p) + 1;
+            p = trim(p, &end);
+            if (inet6_match_add(&b, net, prefix, lpm_value(&v, p, end - p)))
+                die("realloc", 0, strerror(errno));
+            continue;
+        }
+
+        fam1 = parse_number(f1, e1 - f1, &start);
+        p = memchr(p, ',', end - p) + 1;
+        if (!fam1)
+            die(argv[1], lineno, "invalid network or address");
+
+        // start,end,value
+        if ((e2 = memchr(p, ',', end - p)))
+        {
+            const char *q = p;
+
+            f2 = trim(q, &e2);
+            if ((fam2 = parse_number(f2, e2 - f2, &last)))
+            {
+                if (fam1 != fam2 || last < start)
+                    die(argv[1], lineno, "invalid range");
+                p = memchr(p, ',', end - p) + 1;
+                p = trim(p, &end);
+                add_range(&b, start, last, lpm_value(&v, p, end - p));
+                continue;
+            }
+        }
+
+        p = trim(p, &end);
+        add_range(&b, start, start, lpm_value(&v, p, end - p));
+    }
+    if (ferror(in))
+        die(argv[1], 0, strerror(errno));
+    fclose(in);
+    free(line);
+
+    // no values at all, still write the offset of the first
+    if (!v.offsets)
+    {
+        v.offsets = xrealloc(NULL, sizeof(*v.offsets));
+        v.offsets[0] = 0;
+    }
+
+    memset(&m, 0, sizeof(m));
+    if (inet6_match_build(&m, &b))
+        die("realloc", 0, strerror(errno));
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INET6_LPM_MAGIC, sizeof(h.magic));
+    h.version = INET6_LPM_VERSION;
+    h.v4_nodes = m.v4.nodes_used;
+    h.v4_leaves = m.v4.leaves_used;
+    h.v6_nodes = m.v6.nodes_used;
+    h.v6_leaves = m.v6.leaves_used;
+    h.values = v.values;
+    h.strings = v.strings_used;
+
+    temp = xrealloc(NULL, strlen(argv[2]) + 32);
+    sprintf(temp, "%s.tmp.%ld", argv[2], (long) getpid());
+    if (!(out = fopen(temp, "w")))
+        die(temp, 0, strerror(errno));
+    write_all(out, &h, sizeof(h), temp);
+    write_all(out, m.v4.nodes, (size_t) h.v4_nodes * sizeof(inet6_trie_node), temp);
+    write_all(out, m.v6.nodes, (size_t) h.v6_nodes * sizeof(inet6_trie_node), temp);
+    write_all(out, m.v4.leaves, (size_t) h.v4_leaves * sizeof(uint32_t), temp);
+    write_all(out, m.v6.leaves, (size_t) h.v6_leaves * sizeof(uint32_t), temp);
+    write_all(out, v.offsets, ((size_t) h.values + 1) * sizeof(uint32_t), temp);
+    write_all(out, v.strings, h.strings, temp);
+    if (fflush(out) || fsync(fileno(out)) || fclose(out))
+        die(temp, 0, strerror(errno));
+    if (rename(temp, argv[2]))
+        die(argv[2], 0, strerror(errno));
+
+    fprintf(stderr, "inet6_lpm_compile: %s: %u IPv4 and %u IPv6 networks, %u values\n",
+            argv[2], b.v4_used, b.v6_used, v.values);
+    return 0;
+}
@@ -32,6 +32,10 @@ mkdir -p $RPM_BUILD_ROOT/usr/lib/mysql/plugin
 make install 
 cp /usr/lib/mysql/plugin/mysql_udf_ipv6.so $RPM_BUILD_ROOT/usr/lib/mysql/plugin/
 cp /usr/lib/mysql/plugin/mysql_udf_idna.so $RPM_BUILD_ROOT/usr/lib/mysql/plugin/
+mkdir -p $RPM_BUILD_ROOT/usr/bin
+cp /usr/bin/inet6_lpm_compile $RPM_BUILD_ROOT/usr/bin/
+cp /usr/bin/idna_psl_compile $RPM_BUILD_ROOT/usr/bin/
+cp /usr/bin/udf_convert $RPM_BUILD_ROOT/usr/bin/
 
 %files
 %defattr(-,root,root)
@@ -39,4 +43,7 @@ cp /usr/lib/mysql/plugin/mysql_udf_idna.so $RPM_BUILD_ROOT/usr/lib/mysql/plugin/
 %doc Changelog
 /usr/lib/mysql/plugin/mysql_udf_ipv6.so
 /usr/lib/mysql/plugin/mysql_udf_idna.so
+/usr/bin/inet6_lpm_compile
+/usr/bin/idna_psl_compile
+/usr/bin/udf_convert
 
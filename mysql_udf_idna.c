@@ -24,15 +24,23 @@
  *
  * $Id$
  *
- * @TODO: Optimise memory use by using lower-level idna functions
  * @TODO: User default character set from MySQL
  */
 
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <limits.h>
+#include <strings.h>
+#include <iconv.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#include <idna.h>
 #include <stringprep.h>
 
 #include <mysql/mysql.h>
@@ -70,22 +78,1027 @@ void idna_from_ascii2_deinit(UDF_INIT *initid);
 char *idna_from_ascii2(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *length,
         char *null_value, char *error);
 
+my_bool idna_public_suffix_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+void idna_public_suffix_deinit(UDF_INIT *initid);
+char *idna_public_suffix(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *length,
+        char *null_value, char *error);
+
+my_bool idna_registrable_domain_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+void idna_registrable_domain_deinit(UDF_INIT *initid);
+char *idna_registrable_domain(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *length,
+        char *null_value, char *error);
+
+my_bool idna_cache_stats_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+char *idna_cache_stats(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *length,
+        char *null_value, char *error);
+
+// longest charset name kept with a converter
+#define CHARSET_NAME_MAX 63
+
+// charsets converted natively, others go through iconv
+enum { CHARSET_UTF8, CHARSET_LATIN1, CHARSET_UTF16LE, CHARSET_UTF16BE, CHARSET_ICONV };
+
+/**
+ * A charset opened for conversion to or from UTF-8, kept open for as long as
+ * rows keep using it.
+ */
+typedef struct
+{
+    char name[CHARSET_NAME_MAX + 1];    // null-terminated, empty when nothing is open
+    int kind;
+    iconv_t cd;                         // for CHARSET_ICONV, else (iconv_t) -1
+} idna_charset;
+
+/**
+ * Constant arguments and results, worked out once by the *_init functions
+ * and kept in initid->ptr for the row functions.
+ */
+typedef struct
+{
+    idna_charset charset;               // last charset used
+    long length;                        // length of constant result, -1 if not constant
+    char result[MAX_HOSTNAME_LEN + 1];
+} idna_const;
+
+typedef long (*idna_convert_fn)(const char *src, unsigned long length, const idna_charset *charset, char *dst);
+
+// ACE prefix and longest label of RFC 3490
+#define ACE_PREFIX "xn--"
+#define ACE_PREFIX_LEN 4
+#define LABEL_MAX 63
+
+// room for a host name as code points, and for nameprep to expand a label in
+#define UCS4_MAX (MAX_HOSTNAME_LEN + 1)
+#define NAMEPREP_MAX (4 * UCS4_MAX)
+
+/**
+ * Punycode of RFC 3492, writing into fixed buffers.
+ */
+#define PUNY_BASE 36
+#define PUNY_TMIN 1
+#define PUNY_TMAX 26
+#define PUNY_SKEW 38
+#define PUNY_DAMP 700
+#define PUNY_INITIAL_BIAS 72
+#define PUNY_INITIAL_N 0x80
+
+static uint32_t punycode_adapt(uint32_t delta, uint32_t points, int first)
+{
+    uint32_t k = 0;
+
+    delta = first ? delta / PUNY_DAMP : delta / 2;
+    delta += delta / points;
+    while (delta > ((PUNY_BASE - PUNY_TMIN) * PUNY_TMAX) / 2)
+    {
+        delta /= PUNY_BASE - PUNY_TMIN;
+        k += PUNY_BASE;
+    }
+    return k + (PUNY_BASE - PUNY_TMIN + 1) * delta / (delta + PUNY_SKEW);
+}
+
+/**
+ * Encode code points into at most max characters.
+ *
+ * @return number of characters written, or -1 if they do not fit
+ */
+static long punycode_encode(const uint32_t *in, size_t count, char *out, size_t max)
+{
+    uint32_t n = PUNY_INITIAL_N, delta = 0, bias = PUNY_INITIAL_BIAS, h, b, m, q, k, t, digit;
+    size_t i, used = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        if (in[i] < 0x80)
+        {
+            if (used >= max)
+                return -1;
+            out[used++] = (char) in[i];
+        }
+    }
+    h = b = (uint32_t) used;
+    if (b)
+    {
+        if (used >= max)
+            return -1;
+        out[used++] = '-';
+    }
+
+    while (h < count)
+    {
+        for (m = UINT32_MAX, i = 0; i < count; i++)
+            if (in[i] >= n && in[i] < m)
+                m = in[i];
+        if (m - n > (UINT32_MAX - delta) / (h + 1))
+            return -1;
+        delta += (m - n) * (h + 1);
+        n = m;
+
+        for (i = 0; i < count; i++)
+        {
+            if (in[i] < n && ++delta == 0)
+                return -1;
+            if (in[i] != n)
+                continue;
+
+            for (q = delta, k = PUNY_BASE; ; k += PUNY_BASE)
+            {
+                t = k <= bias ? PUNY_TMIN : k >= bias + PUNY_TMAX ? PUNY_TMAX : k - bias;
+                if (q < t)
+                    break;
+                if (used >= max)
+                    return -1;
+                digit = t + (q - t) % (PUNY_BASE - t);
+                out[used++] = (char) (digit < 26 ? digit + 'a' : digit - 26 + '0');
+                q = (q - t) / (PUNY_BASE - t);
+            }
+            if (used >= max)
+                return -1;
+            out[used++] = (char) (q < 26 ? q + 'a' : q - 26 + '0');
+            bias = punycode_adapt(delta, h + 1, h == b);
+            delta = 0;
+            h++;
+        }
+        delta++;
+        n++;
+    }
+    return (long) used;
+}
+
+/**
+ * Decode characters into at most max code points.
+ *
+ * @return number of code points written, or -1 if invalid or they do not fit
+ */
+static long punycode_decode(const uint32_t *in, size_t count, uint32_t *out, size_t max)
+{
+    uint32_t n = PUNY_INITIAL_N, i = 0, bias = PUNY_INITIAL_BIAS, oldi, w, k, t, digit;
+    size_t b = 0, j, in_pos, used;
+
+    for (j = 0; j < count; j++)
+        if (in[j] == '-')
+            b = j;
+    if (b > max)
+        return -1;
+    for (j = 0; j < b; j++)
+    {
+        if (in[j] >= 0x80)
+            return -1;
+        out[j] = in[j];
+    }
+    used = b;
+
+    for (in_pos = b ? b + 1 : 0; in_pos < count; used++)
+    {
+        for (oldi = i, w = 1, k = PUNY_BASE; ; k += PUNY_BASE)
+        {
+            if (in_pos >= count)
+                return -1;
+            digit = in[in_pos++];
+            if (digit - '0' < 10)
+                digit = digit - '0' + 26;
+            else if (digit - 'A' < 26)
+                digit -= 'A';
+            else if (digit - 'a' < 26)
+                digit -= 'a';
+            else
+                return -1;
+            if (digit > (UINT32_MAX - i) / w)
+                return -1;
+            i += digit * w;
+            t = k <= bias ? PUNY_TMIN : k >= bias + PUNY_TMAX ? PUNY_TMAX : k - bias;
+            if (digit < t)
+                break;
+            if (w > UINT32_MAX / (PUNY_BASE - t))
+                return -1;
+            w *= PUNY_BASE - t;
+        }
+
+        bias = punycode_adapt(i - oldi, (uint32_t) used + 1, oldi == 0);
+        if (i / (used + 1) > UINT32_MAX - n)
+            return -1;
+        n += i / (used + 1);
+        i %= used + 1;
+
+        if (used >= max || n > 0x10ffff || (n >= 0xd800 && n < 0xe000))
+            return -1;
+        memmove(out + i + 1, out + i, (used - i) * sizeof(*out));
+        out[i++] = n;
+    }
+    return (long) used;
+}
+
+/**
+ * Decode UTF-8 into at most max code points, rejecting malformed input.
+ *
+ * @return number of code points, or -1 if malformed or they do not fit
+ */
+static long utf8_decode(const unsigned char *src, size_t length, uint32_t *dst, size_t max)
+{
+    size_t used = 0, i = 0;
+
+    while (i < length)
+    {
+        uint32_t c = src[i], min;
+        size_t extra;
+
+        if (c < 0x80)
+            extra = 0, min = 0;
+        else if (c - 0xc2 < 0x1e)
+            extra = 1, c &= 0x1f, min = 0x80;
+        else if (c - 0xe0 < 0x10)
+            extra = 2, c &= 0x0f, min = 0x800;
+        else if (c - 0xf0 < 0x05)
+            extra = 3, c &= 0x07, min = 0x10000;
+        else
+            return -1;
+
+        if (length - i <= extra || used >= max)
+            return -1;
+        for (i++; extra; extra--, i++)
+        {
+            if ((src[i] & 0xc0) != 0x80)
+                return -1;
+            c = (c << 6) | (src[i] & 0x3f);
+        }
+        if (c < min || c > 0x10ffff || (c >= 0xd800 && c < 0xe000))
+            return -1;
+        dst[used++] = c;
+    }
+    return (long) used;
+}
+
+/**
+ * Encode a code point as UTF-8, if it fits in the room left.
+ *
+ * @return number of bytes written, 0 if it does not fit
+ */
+static size_t utf8_encode(uint32_t c, unsigned char *dst, size_t room)
+{
+    if (c < 0x80 && room >= 1)
+    {
+        dst[0] = (unsigned char) c;
+        return 1;
+    }
+    if (c < 0x800 && room >= 2)
+    {
+        dst[0] = (unsigned char) (0xc0 | (c >> 6));
+        dst[1] = (unsigned char) (0x80 | (c & 0x3f));
+        return 2;
+    }
+    if (c < 0x10000 && room >= 3)
+    {
+        dst[0] = (unsigned char) (0xe0 | (c >> 12));
+        dst[1] = (unsigned char) (0x80 | ((c >> 6) & 0x3f));
+        dst[2] = (unsigned char) (0x80 | (c & 0x3f));
+        return 3;
+    }
+    if (c >= 0x10000 && room >= 4)
+    {
+        dst[0] = (unsigned char) (0xf0 | (c >> 18));
+        dst[1] = (unsigned char) (0x80 | ((c >> 12) & 0x3f));
+        dst[2] = (unsigned char) (0x80 | ((c >> 6) & 0x3f));
+        dst[3] = (unsigned char) (0x80 | (c & 0x3f));
+        return 4;
+    }
+    return 0;
+}
+
+// label separators of RFC 3490: full stop, ideographic, fullwidth and halfwidth ideographic full stop
+#define IS_DOT(c)       ((c) == 0x2e || (c) == 0x3002 || (c) == 0xff0e || (c) == 0xff61)
+
+// ascii letters in lower case
+#define ASCII_LOWER(c)  ((c) - 'A' < 26 ? (c) + ('a' - 'A') : (c))
+
+static int idna_is_ascii(const uint32_t *label, size_t length)
+{
+    while (length--)
+        if (*label++ >= 0x80)
+            return 0;
+    return 1;
+}
+
+static int idna_has_ace_prefix(const uint32_t *label, size_t length)
+{
+    size_t i;
+
+    if (length < ACE_PREFIX_LEN)
+        return 0;
+    for (i = 0; i < ACE_PREFIX_LEN; i++)
+        if (ASCII_LOWER(label[i]) != (uint32_t) ACE_PREFIX[i])
+            return 0;
+    return 1;
+}
+
+/**
+ * ToASCII of RFC 3490 for a single label, as libidn does it without flags:
+ * unassigned code points are not allowed, nor checked for STD3 rules.
+ *
+ * @return length of the label written to dst, at most LABEL_MAX, or -1 if invalid
+ */
+static long idna_label_to_ascii(const uint32_t *label, size_t length, char *dst)
+{
+    uint32_t temp[NAMEPREP_MAX];
+    long puny;
+    size_t i;
+
+    // all ascii labels are left as they are
+    if (idna_is_ascii(label, length))
+    {
+        if (length < 1 || length > LABEL_MAX)
+            return -1;
+        for (i = 0; i < length; i++)
+            dst[i] = (char) label[i];
+        return (long) length;
+    }
+
+    memcpy(temp, label, length * sizeof(*label));
+    if (stringprep_4i(temp, &length, NAMEPREP_MAX, STRINGPREP_NO_UNASSIGNED, stringprep_nameprep) != STRINGPREP_OK)
+        return -1;
+
+    if (idna_is_ascii(temp, length))
+    {
+        if (length < 1 || length > LABEL_MAX)
+            return -1;
+        for (i = 0; i < length; i++)
+            dst[i] = (char) temp[i];
+        return (long) length;
+    }
+
+    if (idna_has_ace_prefix(temp, length)
+            || (puny = punycode_encode(temp, length, dst + ACE_PREFIX_LEN, LABEL_MAX - ACE_PREFIX_LEN)) < 1)
+        return -1;
+    memcpy(dst, ACE_PREFIX, ACE_PREFIX_LEN);
+    return puny + ACE_PREFIX_LEN;
+}
+
+/**
+ * ToUnicode of RFC 3490 for a single label. This never fails, labels that
+ * cannot be decoded are returned as they are. The result is never longer
+ * than the label.
+ *
+ * @return length of the label written to dst
+ */
+static size_t idna_label_to_unicode(const uint32_t *label, size_t length, uint32_t *dst)
+{
+    uint32_t temp[NAMEPREP_MAX];
+    char ascii[LABEL_MAX];
+    size_t prepped = length, i;
+    long decoded;
+
+    memcpy(temp, label, length * sizeof(*label));
+    if ((idna_is_ascii(temp, length)
+                || stringprep_4i(temp, &prepped, NAMEPREP_MAX, STRINGPREP_NO_UNASSIGNED, stringprep_nameprep) == STRINGPREP_OK)
+            && idna_has_ace_prefix(temp, prepped)
+            && (decoded = punycode_decode(temp + ACE_PREFIX_LEN, prepped - ACE_PREFIX_LEN, dst, length)) >= 0
+            && idna_label_to_ascii(dst, decoded, ascii) == (long) prepped)
+    {
+        // must encode back to what we started with
+        for (i = 0; i < prepped && ASCII_LOWER((uint32_t) (unsigned char) ascii[i]) == ASCII_LOWER(temp[i]); i++)
+            ;
+        if (i == prepped)
+            return decoded;
+    }
+
+    memcpy(dst, label, length * sizeof(*label));
+    return length;
+}
+
+/**
+ * Scan a host name for anything but plain ASCII labels, working on 8 bytes at
+ * a time. Labels, but for an empty last one, must have 1 to 63 characters.
+ *
+ * @return 0 if not all ASCII, else IDNA_ASCII, with IDNA_ACE if some label
+ *         starts with the ACE prefix, and IDNA_BAD_LENGTH if some label is
+ *         empty or too long
+ */
+#define IDNA_ASCII 1
+#define IDNA_ACE 2
+#define IDNA_BAD_LENGTH 4
+
+// "xn--" in any case
+#define IS_ACE(p)   (((p)[0] | 0x20) == 'x' && ((p)[1] | 0x20) == 'n' && (p)[2] == '-' && (p)[3] == '-')
+
+#define ONES        0x0101010101010101ULL
+#define HIGHS       0x8080808080808080ULL
+#define LOWS        0x7f7f7f7f7f7f7f7fULL
+
+static int idna_scan(const char *src, unsigned long length)
+{
+    const unsigned char *p = (const unsigned char *) src;
+    unsigned long i = 0, label = 0, dot;
+    int ace = 0, bad = 0;
+    uint64_t w, dots;
+
+    if (length == 1 && *p == '.')
+        return IDNA_ASCII;
+
+    for (;;)
+    {
+        // next word, or what is left, with dots as high bits
+        if (i + 8 <= length)
+        {
+            memcpy(&w, p + i, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            w = __builtin_bswap64(w);
+#endif
+            if (w & HIGHS)
+                return 0;
+            dots = w ^ (ONES * '.');
+            dots = ~(((dots & LOWS) + LOWS) | dots | LOWS);
+        }
+        else
+        {
+            dots = 0;
+            for (dot = i; dot < length; dot++)
+            {
+                if (p[dot] >= 0x80)
+                    return 0;
+                if (p[dot] == '.')
+                    dots |= 0x80ULL << ((dot - i) * 8);
+            }
+        }
+
+        for (; dots; dots &= dots - 1)
+        {
+            dot = i + __builtin_ctzll(dots) / 8;
+            bad |= dot - label < 1 || dot - label > LABEL_MAX;
+            ace |= dot - label >= ACE_PREFIX_LEN && IS_ACE(p + label);
+            label = dot + 1;
+        }
+
+        if ((i += 8) >= length)
+            break;
+    }
+
+    // last label, may be empty after a trailing dot
+    bad |= length - label > LABEL_MAX;
+    ace |= length - label >= ACE_PREFIX_LEN && IS_ACE(p + label);
+
+    return IDNA_ASCII | (ace ? IDNA_ACE : 0) | (bad ? IDNA_BAD_LENGTH : 0);
+}
+
+// append a code point to dst, unless it is full
+static void idna_append(uint32_t c, char *dst, size_t *used, int *full)
+{
+    size_t n;
+
+    if (*full)
+        return;
+    if (!(n = utf8_encode(c, (unsigned char *) dst + *used, MAX_HOSTNAME_LEN - *used)))
+        *full = 1;
+    *used += n;
+}
+
+// cannot assume null-terminated strings according to manual, but stop at one like libidn does
+static unsigned long idna_length(const char *src, unsigned long length)
+{
+    const char *nul;
+
+    if ((nul = (const char *) memchr(src, 0, length)))
+        length = nul - src;
+    return length;
+}
+
+// charsets converted without iconv, by their usual iconv names
+static const struct
+{
+    const char *name;
+    int kind;
+} idna_charsets[] = {
+    { "UTF-8", CHARSET_UTF8 },          { "UTF8", CHARSET_UTF8 },
+    { "ISO-8859-1", CHARSET_LATIN1 },   { "ISO8859-1", CHARSET_LATIN1 },
+    { "ISO_8859-1", CHARSET_LATIN1 },   { "LATIN1", CHARSET_LATIN1 },
+    { "L1", CHARSET_LATIN1 },
+    { "UTF-16LE", CHARSET_UTF16LE },    { "UTF16LE", CHARSET_UTF16LE },
+    { "UTF-16BE", CHARSET_UTF16BE },    { "UTF16BE", CHARSET_UTF16BE },
+};
+
+static void idna_charset_close(idna_charset *cs)
+{
+    if (cs->cd != (iconv_t) -1)
+        iconv_close(cs->cd);
+    cs->cd = (iconv_t) -1;
+    cs->name[0] = 0;
+}
+
+/**
+ * Open charset name for conversion to UTF-8 (to_utf8) or from it, unless it
+ * is what cs has open already.
+ *
+ * @return 0, or -1 if the charset is unknown
+ */
+static int idna_charset_open(idna_charset *cs, const char *name, unsigned long length, int to_utf8)
+{
+    size_t i;
+
+    if (cs->name[0] && strlen(cs->name) == length && !memcmp(cs->name, name, length))
+        return 0;
+
+    idna_charset_close(cs);
+    if (length > CHARSET_NAME_MAX || memchr(name, 0, length))
+        return -1;
+    memcpy(cs->name, name, length);
+    cs->name[length] = 0;
+
+    for (i = 0; i < sizeof(idna_charsets) / sizeof(idna_charsets[0]); i++)
+    {
+        if (!strcasecmp(cs->name, idna_charsets[i].name))
+        {
+            cs->kind = idna_charsets[i].kind;
+            return 0;
+        }
+    }
+
+    cs->kind = CHARSET_ICONV;
+    if ((cs->cd = to_utf8 ? iconv_open(DEFAULT_CHARSET, cs->name) : iconv_open(cs->name, DEFAULT_CHARSET)) == (iconv_t) -1)
+    {
+        cs->name[0] = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t utf16_get(int kind, const unsigned char *p)
+{
+    return kind == CHARSET_UTF16LE ? p[0] | (p[1] << 8) : (p[0] << 8) | p[1];
+}
+
+static void utf16_put(int kind, uint32_t c, unsigned char *p)
+{
+    p[kind == CHARSET_UTF16LE] = (unsigned char) (c >> 8);
+    p[kind != CHARSET_UTF16LE] = (unsigned char) c;
+}
+
+/**
+ * Convert a string in charset cs to UTF-8, into at most max bytes.
+ *
+ * @return length written to dst, or -1 if the string is invalid or does not fit
+ */
+static long idna_charset_to_utf8(const idna_charset *cs, const char *src, unsigned long length, char *dst, size_t max)
+{
+    const unsigned char *p = (const unsigned char *) src;
+    unsigned char *out = (unsigned char *) dst;
+    char *in, *o;
+    size_t used = 0, n, in_left, out_left;
+    unsigned long i;
+    uint32_t c, low;
+
+    switch (cs->kind)
+    {
+        case CHARSET_UTF8:
+            if (length > max)
+                return -1;
+            memcpy(dst, src, length);
+            return length;
+
+        case CHARSET_LATIN1:
+            for (i = 0; i < length; i++, used += n)
+                if (!(n = utf8_encode(p[i], out + used, max - used)))
+                    return -1;
+            return used;
+
+        case CHARSET_UTF16LE:
+        case CHARSET_UTF16BE:
+            if (length & 1)
+                return -1;
+            for (i = 0; i < length; used += n)
+            {
+                c = utf16_get(cs->kind, p + i);
+                i += 2;
+                if (c >= 0xdc00 && c < 0xe000)
+                    return -1;
+                if (c >= 0xd800 && c < 0xdc00)
+                {
+                    if (i == length || (low = utf16_get(cs->kind, p + i)) < 0xdc00 || low >= 0xe000)
+                        return -1;
+                    c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                    i += 2;
+                }
+                if (!(n = utf8_encode(c, out + used, max - used)))
+                    return -1;
+            }
+            return used;
+    }
+
+    // iconv, starting from its initial state for every string
+    in = (char *) src;
+    in_left = length;
+    o = dst;
+    out_left = max;
+    iconv(cs->cd, NULL, NULL, NULL, NULL);
+    if (iconv(cs->cd, &in, &in_left, &o, &out_left) == (size_t) -1
+            || iconv(cs->cd, NULL, NULL, &o, &out_left) == (size_t) -1)
+        return -1;
+    return max - out_left;
+}
+
+/**
+ * Convert UTF-8 to charset cs, cut off after the last character that fits
+ * in max bytes.
+ *
+ * @return length written to dst, or -1 if the charset cannot hold the string
+ */
+static long idna_charset_from_utf8(const idna_charset *cs, const char *src, unsigned long length, char *dst, size_t max)
+{
+    uint32_t in[UCS4_MAX], c;
+    unsigned char *out = (unsigned char *) dst;
+    char *in_ptr, *o;
+    size_t used = 0, in_left, out_left;
+    long count, i;
+
+    switch (cs->kind)
+    {
+        case CHARSET_UTF8:
+            used = min(length, max);
+            memcpy(dst, src, used);
+            return used;
+
+        case CHARSET_ICONV:
+            in_ptr = (char *) src;
+            in_left = length;
+            o = dst;
+            out_left = max;
+            iconv(cs->cd, NULL, NULL, NULL, NULL);
+            if ((iconv(cs->cd, &in_ptr, &in_left, &o, &out_left) == (size_t) -1 && errno != E2BIG)
+                    || (iconv(cs->cd, NULL, NULL, &o, &out_left) == (size_t) -1 && errno != E2BIG))
+                return -1;
+            return max - out_left;
+    }
+
+    if ((count = utf8_decode((const unsigned char *) src, length, in, UCS4_MAX)) < 0)
+        return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        c = in[i];
+        if (cs->kind == CHARSET_LATIN1)
+        {
+            // all of it must be latin-1, even what is cut off
+            if (c > 0xff)
+                return -1;
+            if (used < max)
+                out[used++] = (unsigned char) c;
+        }
+        else if (c < 0x10000)
+        {
+            if (max - used < 2)
+                break;
+            utf16_put(cs->kind, c, out + used);
+            used += 2;
+        }
+        else
+        {
+            if (max - used < 4)
+                break;
+            utf16_put(cs->kind, 0xd800 + ((c - 0x10000) >> 10), out + used);
+            utf16_put(cs->kind, 0xdc00 + (c & 0x3ff), out + used + 2);
+            used += 4;
+        }
+    }
+    return used;
+}
+
+/**
+ * Decode a possibly punycoded host name into charset.
+ *
+ * @return length of the result written to dst, or -1 on failure
+ */
+static long idna_decode(const char *src, unsigned long length, const idna_charset *charset, char *dst)
+{
+    uint32_t in[UCS4_MAX], out[UCS4_MAX];
+    char temp[MAX_HOSTNAME_LEN], *utf8 = dst;
+    size_t start, end, n, i, used = 0;
+    long count;
+    int full = 0;
+
+    length = idna_length(src, min(length, MAX_HOSTNAME_LEN));
+    if (charset && charset->kind != CHARSET_UTF8)
+        utf8 = temp;
+
+    // plain ascii without punycoded labels decodes to itself, in latin-1 too
+    if ((utf8 == dst || charset->kind == CHARSET_LATIN1)
+            && (idna_scan(src, length) & (IDNA_ASCII | IDNA_ACE)) == IDNA_ASCII)
+    {
+        memcpy(dst, src, length);
+        return length;
+    }
+
+    if ((count = utf8_decode((const unsigned char *) src, length, in, UCS4_MAX)) < 0)
+        return -1;
+
+    for (start = 0; ; start = end + 1)
+    {
+        for (end = start; end < (size_t) count && !IS_DOT(in[end]); end++)
+            ;
+        n = idna_label_to_unicode(in + start, end - start, out);
+        for (i = 0; i < n; i++)
+            idna_append(out[i], utf8, &used, &full);
+        if (end == (size_t) count)
+            break;
+        idna_append('.', utf8, &used, &full);
+    }
+
+    // convert from utf8 to user encoding
+    if (utf8 != dst)
+        return idna_charset_from_utf8(charset, utf8, used, dst, MAX_HOSTNAME_LEN);
+
+    return used;
+}
+
+/**
+ * Encode a host name given in charset into its ASCII compatible form.
+ *
+ * @return length of the result written to dst, or -1 on failure
+ */
+static long idna_encode(const char *src, unsigned long length, const idna_charset *charset, char *dst)
+{
+    char temp[4 * MAX_HOSTNAME_LEN];
+    char label[LABEL_MAX];
+    uint32_t in[UCS4_MAX];
+    size_t start, end, used = 0;
+    long count, n;
+    int flags;
+
+    // convert from user encoding to utf8, before looking for a null so utf-16 works
+    if (charset && charset->kind != CHARSET_UTF8)
+    {
+        // as many characters as a host name may have, two bytes each in utf-16
+        if (charset->kind == CHARSET_UTF16LE || charset->kind == CHARSET_UTF16BE)
+            length = min(length, 2 * MAX_HOSTNAME_LEN);
+        else
+            length = min(length, MAX_HOSTNAME_LEN);
+        if ((n = idna_charset_to_utf8(charset, src, length, temp, sizeof(temp))) < 0)
+            return -1;
+        src = temp;
+        length = n;
+    }
+    else
+        length = min(length, MAX_HOSTNAME_LEN);
+
+    length = idna_length(src, length);
+
+    // plain ascii is left as it is, if its labels are fine
+    if ((flags = idna_scan(src, length)))
+    {
+        if (!(flags & IDNA_BAD_LENGTH))
+        {
+            used = min(length, MAX_HOSTNAME_LEN);
+            memcpy(dst, src, used);
+        }
+        return flags & IDNA_BAD_LENGTH ? -1 : (long) used;
+    }
+
+    if ((count = utf8_decode((const unsigned char *) src, length, in, UCS4_MAX)) < 0)
+        return -1;
+
+    // a lone dot stays
+    if (count == 1 && IS_DOT(in[0]))
+    {
+        *dst = '.';
+        return 1;
+    }
+
+    for (start = 0; ; start = end + 1)
+    {
+        for (end = start; end < (size_t) count && !IS_DOT(in[end]); end++)
+            ;
+
+        // an empty last label, after a trailing dot
+        if (end == (size_t) count && start == end && start)
+            break;
+        if ((n = idna_label_to_ascii(in + start, end - start, label)) < 0)
+            return -1;
+
+        // like before, just cut off what does not fit
+        if (used < MAX_HOSTNAME_LEN)
+        {
+            memcpy(dst + used, label, min((size_t) n, MAX_HOSTNAME_LEN - used));
+            used += min((size_t) n, MAX_HOSTNAME_LEN - used);
+        }
+        if (end == (size_t) count)
+            break;
+        if (used < MAX_HOSTNAME_LEN)
+            dst[used++] = '.';
+    }
+
+    return used;
+}
+
+/**
+ * Process wide cache of conversions, shared by all connections, as the same
+ * names tend to come by over and over. It is split in shards with a lock
+ * each, so that threads converting different names rarely wait for each
+ * other. Each shard holds a fixed number of entries, reused by the CLOCK
+ * algorithm once it is full. Names that do not convert are cached too.
+ *
+ * Its size is read from the environment of the server on first use:
+ *
+ *   IDNA_CACHE_SIZE    number of entries, 0 to disable (16384)
+ */
+#define IDNA_CACHE_SHARDS 16
+#define IDNA_CACHE_MAXLEN 255       // longer keys are not cached
+#define IDNA_CACHE_MISS -2
+
+typedef struct
+{
+    int32_t next;               // next entry in the hash chain, -1 at the end
+    uint32_t hash;
+    unsigned char referenced;   // looked up since the clock hand last passed
+    unsigned char encode;       // to ascii, or from it
+    unsigned char key_length;
+    int16_t value_length;       // -1 if the name does not convert
+    char key[IDNA_CACHE_MAXLEN];    // charset name, a null, then the host name
+    char value[MAX_HOSTNAME_LEN];
+} idna_cache_entry;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    idna_cache_entry *entries;
+    int32_t *buckets;
+    uint32_t size, used, hand, mask;
+    unsigned long long hits, misses;
+} __attribute__((aligned(64))) idna_cache_shard;
+
+static idna_cache_shard idna_cache[IDNA_CACHE_SHARDS];
+static pthread_once_t idna_cache_once = PTHREAD_ONCE_INIT;
+
+static void idna_cache_init(void)
+{
+    const char *env = getenv("IDNA_CACHE_SIZE");
+    char *end;
+    long size = env && *env ? strtol(env, &end, 10) : 16384;
+    uint32_t shard_size, buckets = 1;
+    uint i, j;
+
+    if (env && *env && (*end || size < 0))
+        size = 16384;
+    shard_size = (uint32_t) min((size + IDNA_CACHE_SHARDS - 1) / IDNA_CACHE_SHARDS, 1L << 24);
+    while (buckets < shard_size)
+        buckets <<= 1;
+
+    for (i = 0; i < IDNA_CACHE_SHARDS; i++)
+    {
+        idna_cache_shard *s = &idna_cache[i];
+
+        pthread_mutex_init(&s->lock, NULL);
+        if (!shard_size)
+            continue;
+
+        // out of memory only means less caching
+        s->entries = (idna_cache_entry *) malloc(shard_size * sizeof(idna_cache_entry));
+        s->buckets = (int32_t *) malloc(buckets * sizeof(int32_t));
+        if (!s->entries || !s->buckets)
+        {
+            free(s->entries);
+            free(s->buckets);
+            s->entries = NULL;
+            s->buckets = NULL;
+            continue;
+        }
+        for (j = 0; j < buckets; j++)
+            s->buckets[j] = -1;
+        s->size = shard_size;
+        s->mask = buckets - 1;
+    }
+}
+
+static uint32_t idna_cache_hash(int encode, const char *key, uint length)
+{
+    uint32_t h = (2166136261U ^ encode) * 16777619U;
+
+    while (length--)
+        h = (h ^ (unsigned char) *key++) * 16777619U;
+    return h ^ (h >> 15);
+}
+
+static idna_cache_shard *idna_cache_shard_of(uint32_t hash)
+{
+    pthread_once(&idna_cache_once, idna_cache_init);
+    return &idna_cache[(hash >> 24) % IDNA_CACHE_SHARDS];
+}
+
+/**
+ * Put together the key of a conversion: the charset as given, or empty, a
+ * null, then the host name.
+ *
+ * @return length of the key, or -1 if it is too long to cache
+ */
+static long idna_cache_key(const char *charset, unsigned long charset_length, const char *src, unsigned long length,
+        char *key)
+{
+    if (charset_length + 1 + length > IDNA_CACHE_MAXLEN)
+        return -1;
+    memcpy(key, charset, charset_length);
+    key[charset_length] = 0;
+    memcpy(key + charset_length + 1, src, length);
+    return charset_length + 1 + length;
+}
+
+// find an entry, with the shard locked
+static idna_cache_entry *idna_cache_find(idna_cache_shard *s, uint32_t hash, int encode, const char *key, uint length)
+{
+    int32_t i;
+
+    for (i = s->buckets[hash & s->mask]; i >= 0; i = s->entries[i].next)
+    {
+        idna_cache_entry *e = &s->entries[i];
+
+        if (e->hash == hash && e->encode == encode && e->key_length == length && !memcmp(e->key, key, length))
+            return e;
+    }
+    return NULL;
+}
+
+/**
+ * Look up a conversion in the cache.
+ *
+ * @return length of the result copied to dst, -1 if the name does not convert,
+ *         IDNA_CACHE_MISS if not in the cache
+ */
+static long idna_cache_get(int encode, const char *key, uint length, char *dst)
+{
+    uint32_t hash = idna_cache_hash(encode, key, length);
+    idna_cache_shard *s = idna_cache_shard_of(hash);
+    idna_cache_entry *e;
+    long found = IDNA_CACHE_MISS;
+
+    if (!s->size)
+        return IDNA_CACHE_MISS;
+
+    pthread_mutex_lock(&s->lock);
+    if ((e = idna_cache_find(s, hash, encode, key, length)))
+    {
+        e->referenced = 1;
+        if ((found = e->value_length) > 0)
+            memcpy(dst, e->value, found);
+        s->hits++;
+    }
+    else
+        s->misses++;
+    pthread_mutex_unlock(&s->lock);
+    return found;
+}
+
+/**
+ * Add a conversion to the cache, value_length -1 if the name does not convert.
+ */
+static void idna_cache_put(int encode, const char *key, uint length, const char *value, long value_length)
+{
+    uint32_t hash = idna_cache_hash(encode, key, length);
+    idna_cache_shard *s = idna_cache_shard_of(hash);
+    idna_cache_entry *e;
+    int32_t *link;
+
+    if (!s->size || value_length > MAX_HOSTNAME_LEN)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    if (!(e = idna_cache_find(s, hash, encode, key, length)))
+    {
+        if (s->used < s->size)
+            e = &s->entries[s->used++];
+        else
+        {
+            // second chance for entries looked up since the hand last passed
+            for (;;)
+            {
+                e = &s->entries[s->hand];
+                s->hand = s->hand + 1 < s->size ? s->hand + 1 : 0;
+                if (!e->referenced)
+                    break;
+                e->referenced = 0;
+            }
+            for (link = &s->buckets[e->hash & s->mask]; *link != e - s->entries; link = &s->entries[*link].next)
+                ;
+            *link = e->next;
+        }
+        e->hash = hash;
+        e->encode = encode;
+        e->key_length = length;
+        memcpy(e->key, key, length);
+        e->next = s->buckets[hash & s->mask];
+        s->buckets[hash & s->mask] = e - s->entries;
+    }
+    e->referenced = 0;
+    e->value_length = value_length;
+    if (value_length > 0)
+        memcpy(e->value, value, value_length);
+    pthread_mutex_unlock(&s->lock);
+}
+
 /**
- * idna_from_ascii()
- *
- * This function decodes a possible ASCII compatible representation of the provided
- * host or domain name. The result is converted into the character set provided in
- * the second argument.
- *
- * @arg    string   a valid host or domain name
- * @arg    string   a valid character set name, default is DEFAULT_CHARSET
- * @return string   ASCII compatible representation of the provided host name
+ * Shared init for both conversions: check the arguments, then open a
+ * constant charset and convert a constant host name just once.
  */
-my_bool idna_from_ascii_init(UDF_INIT *initid, UDF_ARGS *args, char *message)
+static my_bool idna_convert_init(UDF_INIT *initid, UDF_ARGS *args, char *message,
+        const char *usage, idna_convert_fn convert)
 {
+    idna_const *c;
+
     if (args->arg_count < 1 || args->arg_type[0] != STRING_RESULT)
     {
-        strcpy(message, "provide punycoded domain name");
+        strcpy(message, usage);
         return 1;
     }
     if (args->arg_count > 1 && args->arg_type[1] != STRING_RESULT)
@@ -96,159 +1109,663 @@ my_bool idna_from_ascii_init(UDF_INIT *initid, UDF_ARGS *args, char *message)
     initid->max_length = MAX_HOSTNAME_LEN;
     initid->maybe_null = 1;
     initid->const_item = 0;
+
+    // also keeps the converter of a charset only known per row
+    if (!(c = (idna_const *) malloc(sizeof(idna_const))))
+    {
+        strcpy(message, "out of memory");
+        return 1;
+    }
+    c->charset.name[0] = 0;
+    c->charset.cd = (iconv_t) -1;
+    c->length = -1;
+
+    if (args->arg_count > 1 && args->args[1] && args->lengths[1]
+            && idna_charset_open(&c->charset, args->args[1], args->lengths[1], convert == idna_encode))
+    {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "unknown character set %.*s",
+                (int) min(args->lengths[1], CHARSET_NAME_MAX), args->args[1]);
+        free(c);
+        return 1;
+    }
+
+    // constant host name with constant (or no) charset
+    if (args->args[0] && args->lengths[0] && (args->arg_count < 2 || args->args[1]))
+    {
+        if ((c->length = convert(args->args[0], args->lengths[0],
+                c->charset.name[0] ? &c->charset : NULL, c->result)) < 0)
+        {
+            idna_charset_close(&c->charset);
+            free(c);
+            strcpy(message, "invalid domain name");
+            return 1;
+        }
+    }
+
+    initid->ptr = (char *) c;
     return 0;
 }
 
-void idna_from_ascii_deinit(UDF_INIT *initid __attribute__((unused)))
+static void idna_convert_deinit(UDF_INIT *initid)
 {
-}
+    idna_const *c = (idna_const *) initid->ptr;
 
+    if (c)
+    {
+        idna_charset_close(&c->charset);
+        free(c);
+    }
+}
 
-char *idna_from_ascii(UDF_INIT *initid __attribute__((unused)), UDF_ARGS *args, char *result, unsigned long *res_length,
-        char *null_value, char *error __attribute__((unused)))
+static char *idna_convert(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *res_length,
+        char *null_value, idna_convert_fn convert)
 {
-    char temp[MAX_HOSTNAME_LEN+1];
-    char *temp2;
-    char *charset = NULL;
-    uint length;
+    idna_const *c = (idna_const *) initid->ptr;
+    const idna_charset *charset = NULL;
+    const char *charset_name = "";
+    unsigned long charset_length = 0;
+    char key[IDNA_CACHE_MAXLEN];
+    long length, key_length;
+    int encode = convert == idna_encode;
+
+    if (c->length >= 0)
+    {
+        *res_length = c->length;
+        return c->result;
+    }
 
-    if (!args->args[0] || !(length = args->lengths[0]))
+    if (!args->args[0] || !args->lengths[0])
     {
         *null_value = 1;
         return 0;
     }
 
-    if (args->arg_count > 1 && args->args[1] && args->lengths[1])
+    if (args->arg_count > 1 && args->args[1])
     {
-    	charset = args->args[1];
+        charset_name = args->args[1];
+        charset_length = args->lengths[1];
     }
 
-    // cannot assume null-terminated string according to manual
-    if (length >= sizeof(temp))
-        length = sizeof(temp) - 1;
-    memcpy(temp, args->args[0], length);
-    temp[length] = 0;
+    key_length = idna_cache_key(charset_name, charset_length, args->args[0], args->lengths[0], key);
+    if (key_length < 0 || (length = idna_cache_get(encode, key, key_length, result)) == IDNA_CACHE_MISS)
+    {
+        // opened by init when constant, reopened here only when it changes
+        if (charset_length)
+        {
+            if (idna_charset_open(&c->charset, charset_name, charset_length, encode))
+            {
+                *null_value = 1;
+                return 0;
+            }
+            charset = &c->charset;
+        }
+
+        length = convert(args->args[0], args->lengths[0], charset, result);
+        if (key_length >= 0)
+            idna_cache_put(encode, key, key_length, result, length);
+    }
 
-    // convert to utf8
-    if (idna_to_unicode_8z8z(temp, &temp2, 0) != IDNA_SUCCESS)
+    if (length < 0)
     {
         *null_value = 1;
         return 0;
     }
 
-    // convert from utf8 to user encoding
-    if (charset)
+    *res_length = length;
+
+    return result;
+}
+
+/**
+ * Public suffix list files, as written by idna_psl_compile from the list at
+ * https://publicsuffix.org/ and read by idna_public_suffix() and
+ * idna_registrable_domain(). The file holds the rules as a trie of labels,
+ * from the top level domain down, in ASCII compatible form and lower case.
+ * Children are found by hashing their parent and label. It is used in place
+ * via mmap:
+ *
+ *   idna_psl_header
+ *   uint32_t           1-based first node of each hash chain, 0 if none
+ *   idna_psl_node      nodes, the root first
+ *   char               labels, not null-terminated
+ *
+ * All numbers are in host byte order; version doubles as byte order mark.
+ */
+#define IDNA_PSL_MAGIC "IDNAPSL\0"
+#define IDNA_PSL_VERSION 1
+
+// default file, unless given as argument or in IDNA_PSL_FILE in the environment of the server
+#define DEFAULT_PSL_FILE "/var/lib/mysql-udf-idna/public_suffix_list.psl"
+
+// labels of a host name at most, as each takes two bytes with its dot
+#define PSL_LABELS_MAX (MAX_HOSTNAME_LEN / 2 + 1)
+
+enum
+{
+    PSL_RULE = 1,           // the labels down to this node are a rule
+    PSL_WILDCARD = 2,       // any label below this node is a rule, like *.ck
+    PSL_EXCEPTION = 4       // not a rule after all, like !www.ck
+};
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t buckets;           // a power of two
+    uint32_t nodes;
+    uint32_t strings;           // bytes of labels
+} idna_psl_header;
+
+typedef struct
+{
+    uint32_t parent;
+    uint32_t next;              // 1-based next node in the hash chain, always further on, 0 at the end
+    uint32_t label;             // offset of the label
+    uint8_t length;
+    uint8_t flags;
+    uint16_t reserved;
+} idna_psl_node;
+
+/**
+ * A mapped list file. Lists are shared by all threads and kept in a list of
+ * their own, so every file is mapped once per process. Each UDF_INIT holds a
+ * reference to the list that was current at init time, and looks up without
+ * locking. When the file is replaced, the next init maps the new file, and
+ * the old one is unmapped once its last query finishes.
+ */
+typedef struct idna_psl_table
+{
+    struct idna_psl_table *next;
+    char *path;
+    struct stat st;             // of the mapped file, to notice replacements
+    void *map;
+    const uint32_t *buckets;
+    const idna_psl_node *nodes;
+    const char *strings;
+    uint32_t mask;
+    uint refs;                  // UDF_INITs using this list
+    int current;                // still the latest for path?
+} idna_psl_table;
+
+static pthread_mutex_t idna_psl_lock = PTHREAD_MUTEX_INITIALIZER;
+static idna_psl_table *idna_psl_tables;
+
+static uint32_t idna_psl_hash(uint32_t parent, const char *label, size_t length)
+{
+    uint32_t h = (2166136261U ^ parent) * 16777619U;
+
+    while (length--)
+        h = (h ^ (unsigned char) *label++) * 16777619U;
+    return h ^ (h >> 15);
+}
+
+/**
+ * Child of node parent with a label, which must be in lower case.
+ *
+ * @return its index, or 0 if there is none
+ */
+static uint32_t idna_psl_child(const uint32_t *buckets, uint32_t mask, const idna_psl_node *nodes,
+        const char *strings, uint32_t parent, const char *label, size_t length)
+{
+    uint32_t i;
+
+    for (i = buckets[idna_psl_hash(parent, label, length) & mask]; i; i = nodes[i - 1].next)
     {
-    	char *temp3 = temp2;
-    	temp2 = stringprep_convert(temp2, DEFAULT_CHARSET, charset);
-    	free(temp3);
+        const idna_psl_node *n = &nodes[i - 1];
 
-    	if (!temp2)
-        {
-            *null_value = 1;
-            return 0;
-        }
+        if (n->parent == parent && n->length == length && !memcmp(strings + n->label, label, length))
+            return i - 1;
+    }
+    return 0;
+}
+
+/**
+ * Map and check a list file.
+ *
+ * @return the list, or NULL with message set
+ */
+static idna_psl_table *idna_psl_open(const char *path, const struct stat *st, char *message)
+{
+    const idna_psl_header *h;
+    idna_psl_table *t;
+    uint64_t size;
+    uint32_t i;
+    int fd;
+
+    if (st->st_size < (off_t) sizeof(idna_psl_header))
+    {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "%.400s is not a public suffix list file", path);
+        return NULL;
+    }
+    if (!(t = calloc(1, sizeof(*t))) || !(t->path = strdup(path)))
+    {
+        free(t);
+        strcpy(message, "out of memory");
+        return NULL;
     }
+    t->st = *st;
 
-    strncpy(result, temp2, initid->max_length);
+    if ((fd = open(path, O_RDONLY)) < 0
+            || (t->map = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "cannot map %.400s", path);
+        if (fd >= 0)
+            close(fd);
+        free(t->path);
+        free(t);
+        return NULL;
+    }
+    close(fd);
 
-    free(temp2);
+    h = (const idna_psl_header *) t->map;
+    size = sizeof(*h) + (uint64_t) h->buckets * sizeof(uint32_t) + (uint64_t) h->nodes * sizeof(idna_psl_node)
+            + h->strings;
+    if (memcmp(h->magic, IDNA_PSL_MAGIC, sizeof(h->magic)) || h->version != IDNA_PSL_VERSION
+            || !h->buckets || (h->buckets & (h->buckets - 1)) || !h->nodes || size != (uint64_t) st->st_size)
+        goto bad;
 
-    *res_length = strlen(result);
+    t->buckets = (const uint32_t *) (h + 1);
+    t->nodes = (const idna_psl_node *) (t->buckets + h->buckets);
+    t->strings = (const char *) (t->nodes + h->nodes);
+    t->mask = h->buckets - 1;
 
-    return result;
+    // lookups must stay within the file, and hash chains must end
+    for (i = 0; i < h->buckets; i++)
+    {
+        if (t->buckets[i] > h->nodes)
+            goto bad;
+    }
+    for (i = 0; i < h->nodes; i++)
+    {
+        const idna_psl_node *n = &t->nodes[i];
+
+        if ((i && n->parent >= i) || (n->next && (n->next <= i + 1 || n->next > h->nodes))
+                || n->length > LABEL_MAX || (uint64_t) n->label + n->length > h->strings)
+            goto bad;
+    }
+    return t;
+
+bad:
+    snprintf(message, MYSQL_ERRMSG_SIZE, "%.400s is not a valid public suffix list file", path);
+    munmap(t->map, st->st_size);
+    free(t->path);
+    free(t);
+    return NULL;
+}
+
+// call with idna_psl_lock held
+static void idna_psl_close(idna_psl_table *t)
+{
+    idna_psl_table **pp;
+
+    for (pp = &idna_psl_tables; *pp != t; pp = &(*pp)->next)
+        ;
+    *pp = t->next;
+    munmap(t->map, t->st.st_size);
+    free(t->path);
+    free(t);
 }
 
 /**
- * idna_to_ascii()
+ * Get a reference to the current list for path, mapping the file when it
+ * is not mapped yet or has been replaced since.
  *
- * This function returns an ASCII compatible representation of the provided (internationalised) host or
- * domain name, which should be encoded as indicated by the provided character set.
+ * @return the list, or NULL with message set
+ */
+static idna_psl_table *idna_psl_acquire(const char *path, char *message)
+{
+    idna_psl_table *t, *old = NULL;
+    struct stat st;
+
+    if (stat(path, &st))
+    {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "cannot open %.400s", path);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&idna_psl_lock);
+
+    for (t = idna_psl_tables; t; t = t->next)
+    {
+        if (t->current && !strcmp(t->path, path))
+            break;
+    }
+    if (t && (t->st.st_dev != st.st_dev || t->st.st_ino != st.st_ino
+            || t->st.st_mtime != st.st_mtime || t->st.st_size != st.st_size))
+    {
+        old = t;
+        t = NULL;
+    }
+    if (!t)
+    {
+        if (!(t = idna_psl_open(path, &st, message)))
+        {
+            pthread_mutex_unlock(&idna_psl_lock);
+            return NULL;
+        }
+        t->current = 1;
+        t->next = idna_psl_tables;
+        idna_psl_tables = t;
+
+        // replaced: new queries get the new list, running ones keep the old
+        if (old)
+        {
+            old->current = 0;
+            if (!old->refs)
+                idna_psl_close(old);
+        }
+    }
+    t->refs++;
+
+    pthread_mutex_unlock(&idna_psl_lock);
+    return t;
+}
+
+static void idna_psl_release(idna_psl_table *t)
+{
+    pthread_mutex_lock(&idna_psl_lock);
+    if (!--t->refs && !t->current)
+        idna_psl_close(t);
+    pthread_mutex_unlock(&idna_psl_lock);
+}
+
+/**
+ * Number of labels in the public suffix of a host name, given as lower case
+ * labels from right to left. Exception rules win over all others, else the
+ * longest rule does, else the top level domain is the suffix.
  *
- * @arg    string   a valid host or domain name
- * @arg    string   a valid character set name, default is DEFAULT_CHARSET
- * @return string   ASCII compatible representation of the provided host name
+ * @return labels in the suffix, at least 1 and at most count
  */
-my_bool idna_to_ascii_init(UDF_INIT *initid, UDF_ARGS *args, char *message)
+static uint idna_psl_suffix(const idna_psl_table *t, const char *const *labels, const uint8_t *lengths, uint count)
 {
-    if (args->arg_count < 1 || args->arg_type[0] != STRING_RESULT)
+    uint32_t node = 0, child;
+    uint depth, suffix = 1;
+
+    for (depth = 0; depth < count; depth++)
     {
-        strcpy(message, "provide domain name to punycode");
-        return 1;
+        // a wildcard takes any label below its node
+        if (t->nodes[node].flags & PSL_WILDCARD)
+            suffix = max(suffix, depth + 1);
+
+        if (!(child = idna_psl_child(t->buckets, t->mask, t->nodes, t->strings, node, labels[depth], lengths[depth])))
+            break;
+        node = child;
+
+        if (t->nodes[node].flags & PSL_EXCEPTION)
+            return max(depth, 1);
+
+        // like browsers and libpsl, the parent of a wildcard is a suffix as well
+        if (t->nodes[node].flags & (PSL_RULE | PSL_WILDCARD))
+            suffix = max(suffix, depth + 1);
     }
-    if (args->arg_count > 1 && args->arg_type[1] != STRING_RESULT)
+    return suffix;
+}
+
+/**
+ * Shared init for the public suffix functions: map the list file given, or
+ * the default one.
+ */
+static my_bool idna_psl_init(UDF_INIT *initid, UDF_ARGS *args, char *message, const char *usage)
+{
+    char path[PATH_MAX];
+    const char *file;
+
+    if (args->arg_count < 1 || args->arg_count > 2 || args->arg_type[0] != STRING_RESULT
+            || (args->arg_count > 1 && args->arg_type[1] != STRING_RESULT))
     {
-        strcpy(message, "provide valid character set");
+        strcpy(message, usage);
         return 1;
     }
+    if (args->arg_count > 1)
+    {
+        if (!args->args[1] || !args->lengths[1] || args->lengths[1] >= sizeof(path))
+        {
+            strcpy(message, "public suffix list file must be a constant path");
+            return 1;
+        }
+        memcpy(path, args->args[1], args->lengths[1]);
+        path[args->lengths[1]] = 0;
+    }
+    else if ((file = getenv("IDNA_PSL_FILE")) && *file)
+        snprintf(path, sizeof(path), "%s", file);
+    else
+        strcpy(path, DEFAULT_PSL_FILE);
+
     initid->max_length = MAX_HOSTNAME_LEN;
     initid->maybe_null = 1;
     initid->const_item = 0;
+
+    if (!(initid->ptr = (char *) idna_psl_acquire(path, message)))
+        return 1;
     return 0;
 }
 
-void idna_to_ascii_deinit(UDF_INIT *initid __attribute__((unused)))
+static void idna_psl_deinit(UDF_INIT *initid)
 {
+    idna_psl_release((idna_psl_table *) initid->ptr);
 }
 
-char *idna_to_ascii(UDF_INIT *initid __attribute__((unused)), UDF_ARGS *args, char *result, unsigned long *res_length,
-        char *null_value, char *error __attribute__((unused)))
+/**
+ * Shared row function for the public suffix functions. The host name is
+ * converted to its ASCII compatible form in lower case first, so that all
+ * forms of a name give the same result.
+ */
+static char *idna_psl(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *res_length,
+        char *null_value, int registrable)
 {
-    char temp[MAX_HOSTNAME_LEN+1];
-    char *temp2, *temp3;
-    char *charset = NULL;
-    uint length;
+    const idna_psl_table *t = (const idna_psl_table *) initid->ptr;
+    const char *labels[PSL_LABELS_MAX], *start;
+    uint8_t lengths[PSL_LABELS_MAX];
+    uint count = 0, suffix;
+    long length, i, end;
 
-    if (!args->args[0] || !(length = args->lengths[0]))
+    if (!args->args[0] || !args->lengths[0]
+            || (length = idna_encode(args->args[0], args->lengths[0], NULL, result)) <= 0)
     {
         *null_value = 1;
         return 0;
     }
 
-    if (args->arg_count > 1 && args->args[1] && args->lengths[1])
+    // the same with or without a trailing dot
+    if (result[length - 1] == '.')
+        length--;
+    for (i = 0; i < length; i++)
+        result[i] = (char) ASCII_LOWER((uint32_t) (unsigned char) result[i]);
+
+    // labels from right to left, none of them empty
+    for (end = length, i = length - 1; ; i--)
     {
-    	charset = args->args[1];
+        if (i >= 0 && result[i] != '.')
+            continue;
+        if (end - i - 1 < 1 || end - i - 1 > LABEL_MAX)
+        {
+            *null_value = 1;
+            return 0;
+        }
+        labels[count] = result + i + 1;
+        lengths[count++] = (uint8_t) (end - i - 1);
+        if (i < 0)
+            break;
+        end = i;
     }
 
-    // cannot assume null-terminated string according to manual
-    if (length >= sizeof(temp))
-        length = sizeof(temp) - 1;
-    memcpy(temp, args->args[0], length);
-    temp[length] = 0;
-
-    // convert from user encoding to utf8
-    if (charset)
+    suffix = idna_psl_suffix(t, labels, lengths, count);
+    if (registrable)
     {
-    	temp2 = stringprep_convert(temp, charset, DEFAULT_CHARSET);
-
-    	if (!temp2)
+        // a public suffix itself has no registrable domain
+        if (suffix >= count)
         {
             *null_value = 1;
             return 0;
         }
+        start = labels[suffix];
     }
     else
+        start = labels[suffix - 1];
+
+    *res_length = result + length - start;
+    return (char *) start;
+}
+
+/**
+ * idna_from_ascii()
+ *
+ * This function decodes a possible ASCII compatible representation of the provided
+ * host or domain name. The result is converted into the character set provided in
+ * the second argument.
+ *
+ * @arg    string   a valid host or domain name
+ * @arg    string   a valid character set name, default is DEFAULT_CHARSET
+ * @return string   ASCII compatible representation of the provided host name
+ */
+my_bool idna_from_ascii_init(UDF_INIT *initid, UDF_ARGS *args, char *message)
+{
+    return idna_convert_init(initid, args, message, "provide punycoded domain name", idna_decode);
+}
+
+void idna_from_ascii_deinit(UDF_INIT *initid)
+{
+    idna_convert_deinit(initid);
+}
+
+
+char *idna_from_ascii(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *res_length,
+        char *null_value, char *error __attribute__((unused)))
+{
+    return idna_convert(initid, args, result, res_length, null_value, idna_decode);
+}
+
+/**
+ * idna_to_ascii()
+ *
+ * This function returns an ASCII compatible representation of the provided (internationalised) host or
+ * domain name, which should be encoded as indicated by the provided character set.
+ *
+ * @arg    string   a valid host or domain name
+ * @arg    string   a valid character set name, default is DEFAULT_CHARSET
+ * @return string   ASCII compatible representation of the provided host name
+ */
+my_bool idna_to_ascii_init(UDF_INIT *initid, UDF_ARGS *args, char *message)
+{
+    return idna_convert_init(initid, args, message, "provide domain name to punycode", idna_encode);
+}
+
+void idna_to_ascii_deinit(UDF_INIT *initid)
+{
+    idna_convert_deinit(initid);
+}
+
+char *idna_to_ascii(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *res_length,
+        char *null_value, char *error __attribute__((unused)))
+{
+    return idna_convert(initid, args, result, res_length, null_value, idna_encode);
+}
+
+/**
+ * idna_cache_stats()
+ *
+ * This function returns how well the cache of conversions shared by
+ * idna_to_ascii() and idna_from_ascii() does, as a JSON object with the number
+ * of hits and misses since the library was loaded, and the number of entries
+ * in use and in all.
+ *
+ * @return string   like {"hits": 1234, "misses": 56, "entries": 56, "size": 16384}
+ */
+my_bool idna_cache_stats_init(UDF_INIT *initid, UDF_ARGS *args, char *message)
+{
+    if (args->arg_count != 0)
     {
-    	temp2 = temp;
+        strcpy(message, "IDNA_CACHE_STATS takes no arguments.");
+        return 1;
     }
+    initid->max_length = 255;
+    initid->maybe_null = 0;
+    initid->const_item = 0;
+    return 0;
+}
 
-    // convert to utf8
-    if (idna_to_ascii_8z(temp2, &temp3, 0) != IDNA_SUCCESS)
+char *idna_cache_stats(UDF_INIT *initid __attribute__((unused)), UDF_ARGS *args __attribute__((unused)),
+        char *result, unsigned long *res_length, char *null_value __attribute__((unused)),
+        char *error __attribute__((unused)))
+{
+    unsigned long long hits = 0, misses = 0, used = 0, size = 0;
+    uint i;
+
+    pthread_once(&idna_cache_once, idna_cache_init);
+    for (i = 0; i < IDNA_CACHE_SHARDS; i++)
     {
-    	if (charset)
-    		free(temp2);
-        *null_value = 1;
-        return 0;
+        idna_cache_shard *s = &idna_cache[i];
+
+        pthread_mutex_lock(&s->lock);
+        hits += s->hits;
+        misses += s->misses;
+        used += s->used;
+        size += s->size;
+        pthread_mutex_unlock(&s->lock);
     }
 
-    strncpy(result, temp3, initid->max_length);
+    *res_length = sprintf(result, "{\"hits\": %llu, \"misses\": %llu, \"entries\": %llu, \"size\": %llu}",
+            hits, misses, used, size);
+    return result;
+}
+
+/**
+ * idna_public_suffix()
+ *
+ * This function returns the public suffix of a host name, the part under which
+ * anyone can register names, like "com" or "co.uk", according to the Public
+ * Suffix List. The list is read from a file made with idna_psl_compile, mapped
+ * once and shared by all connections. The result is in ASCII compatible form
+ * and lower case, for internationalised and punycoded names alike.
+ *
+ * Example: SELECT IDNA_PUBLIC_SUFFIX('www.example.co.uk'); -- co.uk
+ *
+ * @arg    string   a host name
+ * @arg    string   constant path of the list file, default is IDNA_PSL_FILE from the
+ *                  environment of the server, or DEFAULT_PSL_FILE
+ * @return string   public suffix of the host name
+ */
+my_bool idna_public_suffix_init(UDF_INIT *initid, UDF_ARGS *args, char *message)
+{
+    return idna_psl_init(initid, args, message, "provide host name and optionally public suffix list file");
+}
+
+void idna_public_suffix_deinit(UDF_INIT *initid)
+{
+    idna_psl_deinit(initid);
+}
 
-    if (charset)
-    	free(temp2);
+char *idna_public_suffix(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *res_length,
+        char *null_value, char *error __attribute__((unused)))
+{
+    return idna_psl(initid, args, result, res_length, null_value, 0);
+}
 
-    free(temp3);
+/**
+ * idna_registrable_domain()
+ *
+ * This function returns the registrable domain of a host name: its public suffix
+ * with one more label, like "example.co.uk" for "www.example.co.uk". It returns
+ * NULL for a public suffix itself. Like idna_public_suffix(), the result is in
+ * ASCII compatible form and lower case.
+ *
+ * @arg    string   a host name
+ * @arg    string   constant path of the list file, default is IDNA_PSL_FILE from the
+ *                  environment of the server, or DEFAULT_PSL_FILE
+ * @return string   registrable domain of the host name
+ */
+my_bool idna_registrable_domain_init(UDF_INIT *initid, UDF_ARGS *args, char *message)
+{
+    return idna_psl_init(initid, args, message, "provide host name and optionally public suffix list file");
+}
 
-    *res_length = strlen(result);
+void idna_registrable_domain_deinit(UDF_INIT *initid)
+{
+    idna_psl_deinit(initid);
+}
 
-    return result;
+char *idna_registrable_domain(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *res_length,
+        char *null_value, char *error __attribute__((unused)))
+{
+    return idna_psl(initid, args, result, res_length, null_value, 1);
 }
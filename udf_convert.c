@@ -0,0 +1,505 @@
+/**
+ * udf_convert.c
+ *
+ * Convert fields of a large CSV or TSV file, like an access log, with the
+ * same code as the inet6_pton(), inet6_mask() and idna_to_ascii() MySQL
+ * functions, into a file for LOAD DATA INFILE.
+ *
+ * Usage: udf_convert [-b] [-H] [-d delimiter] [-t threads] -c field=conversion ... input [output]
+ *
+ * Fields are numbered from 1, and each -c selects one of them and what to
+ * make of it:
+ *
+ *   pton           binary address, like inet6_pton()
+ *   mask/N         binary network of the address, like inet6_mask(inet6_pton(f), N)
+ *   mask/N,M       the same, with N for IPv4 and M for IPv6 addresses
+ *   ascii          ASCII compatible host name, like idna_to_ascii()
+ *
+ * As with inet6_mask(), addresses shorter than the prefix become NULL, so
+ * mask/64 only suits columns of IPv6 addresses.
+ *
+ * Other fields are copied as they are. Fields are separated by tabs, or by
+ * the delimiter given with -d; a field that starts with a double quote runs
+ * until the closing quote, and such quotes are removed from fields that are
+ * converted. Values that do not convert become \N, which loads as NULL.
+ *
+ * Binary columns are written in hex, to be loaded with UNHEX():
+ *
+ *   LOAD DATA INFILE 'log.tsv' INTO TABLE log (@ip, host)
+ *       SET ip = UNHEX(@ip);
+ *
+ * or with -b as raw bytes, escaped the way LOAD DATA expects by default. The
+ * delimiter given with -d must then be the FIELDS TERMINATED BY of the load.
+ * With -H the first line is a header and copied as it is.
+ *
+ * The input is mapped into memory and cut into chunks at line ends, which
+ * are converted by as many threads as there are processors, or as given
+ * with -t, and written in order. Throughput is reported on stderr.
+ *
+ * Copyright (c) 2011 WatchMouse
+ *
+ * Licensed under the EUPL, Version 1.1 or – as soon they will be approved
+ * by the European Commission - subsequent versions of the EUPL (the "Licence");
+ * You may not use this work except in compliance with the Licence. You may
+ * obtain a copy of the Licence at:
+ *
+ *   http://ec.europa.eu/idabc/eupl
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ */
+
+// shares the conversions with the UDFs
+#include "mysql_udf_ipv6.c"
+#include "mysql_udf_idna.c"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define CONVERT_CHUNK (16 << 20)
+#define CONVERT_FIELDS 64
+
+enum
+{
+    CONVERT_COPY = 0, CONVERT_PTON, CONVERT_MASK, CONVERT_ASCII
+};
+
+typedef struct
+{
+    int kind;
+    uint prefix4, prefix6;
+} convert_field;
+
+// a piece of the input ending at a line end, and what it converts to
+typedef struct
+{
+    const char *start, *end;
+    char *out;
+    size_t used, size;
+    unsigned long lines, invalid;
+    int done;
+} convert_chunk;
+
+typedef struct
+{
+    convert_field fields[CONVERT_FIELDS];
+    uint field_count;
+    char delimiter;
+    int binary;
+
+    convert_chunk *chunks;
+    size_t chunk_count, next, written, window;
+    pthread_mutex_t lock;
+    pthread_cond_t ready, taken;
+} convert_job;
+
+static void die(const char *file, const char *what)
+{
+    fprintf(stderr, "udf_convert: %s: %s\n", file, what);
+    exit(1);
+}
+
+static void *xrealloc(void *p, size_t size)
+{
+    if (!(p = realloc(p, size)))
+        die("realloc", strerror(errno));
+    return p;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: udf_convert [-b] [-H] [-d delimiter] [-t threads] -c field=conversion ... input [output]\n"
+            "conversions: pton, mask/N, mask/N,M, ascii\n");
+    exit(2);
+}
+
+// parse one -c argument, like 3=mask/24,64
+static int parse_field(convert_job *job, const char *arg)
+{
+    char *end;
+    unsigned long field = strtoul(arg, &end, 10);
+    convert_field *f;
+
+    if (end == arg || *end != '=' || field < 1 || field > CONVERT_FIELDS)
+        return -1;
+    f = &job->fields[field - 1];
+    arg = end + 1;
+
+    if (!strcmp(arg, "pton"))
+        f->kind = CONVERT_PTON;
+    else if (!strcmp(arg, "ascii"))
+        f->kind = CONVERT_ASCII;
+    else if (!strncmp(arg, "mask/", 5))
+    {
+        f->kind = CONVERT_MASK;
+        f->prefix4 = f->prefix6 = strtoul(arg + 5, &end, 10);
+        if (end == arg + 5)
+            return -1;
+        if (*end == ',')
+        {
+            arg = end + 1;
+            f->prefix6 = strtoul(arg, &end, 10);
+            if (end == arg)
+                return -1;
+        }
+        if (*end || f->prefix4 > INET6_ADDRLEN * CHAR_BIT || f->prefix6 > INET6_ADDRLEN * CHAR_BIT)
+            return -1;
+    }
+    else
+        return -1;
+
+    job->field_count = max(job->field_count, field);
+    return 0;
+}
+
+static void reserve(convert_chunk *c, size_t length)
+{
+    if (c->size - c->used < length)
+    {
+        c->size = c->size * 2 + length;
+        c->out = xrealloc(c->out, c->size);
+    }
+}
+
+static void append(convert_chunk *c, const char *src, size_t length)
+{
+    reserve(c, length);
+    memcpy(c->out + c->used, src, length);
+    c->used += length;
+}
+
+// bytes as LOAD DATA reads them with its default ESCAPED BY '\\'
+static void append_escaped(convert_chunk *c, const char *src, size_t length, char delimiter)
+{
+    char *dst;
+    size_t i;
+
+    reserve(c, 2 * length);
+    dst = c->out + c->used;
+    for (i = 0; i < length; i++)
+    {
+        char ch = src[i];
+
+        switch (ch)
+        {
+        case '\0': *dst++ = '\\'; *dst++ = '0'; break;
+        case '\n': *dst++ = '\\'; *dst++ = 'n'; break;
+        case '\r': *dst++ = '\\'; *dst++ = 'r'; break;
+        case '\t': *dst++ = '\\'; *dst++ = 't'; break;
+        case '\\':
+        case '"':
+            *dst++ = '\\';
+            *dst++ = ch;
+            break;
+        default:
+            if (ch == delimiter)
+                *dst++ = '\\';
+            *dst++ = ch;
+        }
+    }
+    c->used = dst - c->out;
+}
+
+static void append_hex(convert_chunk *c, const unsigned char *src, size_t length)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    char *dst;
+    size_t i;
+
+    reserve(c, 2 * length);
+    dst = c->out + c->used;
+    for (i = 0; i < length; i++)
+    {
+        *dst++ = digits[src[i] >> 4];
+        *dst++ = digits[src[i] & 0xf];
+    }
+    c->used = dst - c->out;
+}
+
+// the end of the field at p, which is either the delimiter or the line end
+static const char *field_end(const char *p, const char *end, char delimiter)
+{
+    if (p < end && *p == '"')
+    {
+        // quotes inside are doubled, so this just toggles in and out of them
+        int quoted = 0;
+
+        for (; p < end; p++)
+        {
+            if (*p == '"')
+                quoted = !quoted;
+            else if (*p == delimiter && !quoted)
+                break;
+        }
+        return p;
+    }
+    if (!(p = memchr(p, delimiter, end - p)))
+        return end;
+    return p;
+}
+
+static void convert_value(convert_job *job, convert_chunk *c, const convert_field *f, const char *src, size_t length)
+{
+    unsigned char address[INET6_ADDRLEN];
+    char ascii[MAX_HOSTNAME_LEN];
+    long n = 0;
+
+    if (length >= 2 && src[0] == '"' && src[length - 1] == '"')
+    {
+        src++;
+        length -= 2;
+    }
+
+    switch (f->kind)
+    {
+    case CONVERT_PTON:
+        n = inet6_parse(src, length, address);
+        break;
+    case CONVERT_MASK:
+        // a prefix longer than the address is NULL, like with inet6_mask()
+        if ((n = inet6_parse(src, length, address)))
+        {
+            uint prefix = n == INET_ADDRLEN ? f->prefix4 : f->prefix6;
+
+            if (prefix > n * CHAR_BIT)
+                n = 0;
+            else
+                inet6_mask_words((char *) address, n, prefix, 0, (char *) address);
+        }
+        break;
+    case CONVERT_ASCII:
+        if (length && (n = idna_encode(src, length, NULL, ascii)) > 0)
+        {
+            append_escaped(c, ascii, n, job->delimiter);
+            return;
+        }
+        n = 0;
+        break;
+    }
+
+    if (!n)
+    {
+        append(c, "\\N", 2);
+        c->invalid++;
+    }
+    else if (job->binary)
+        append_escaped(c, (char *) address, n, job->delimiter);
+    else
+        append_hex(c, address, n);
+}
+
+static void convert_lines(convert_job *job, convert_chunk *c)
+{
+    const char *p = c->start, *end, *stop, *field;
+    uint i;
+
+    c->size = (c->end - c->start) * 2 + 64;
+    c->out = xrealloc(NULL, c->size);
+
+    for (; p < c->end; p = end)
+    {
+        // fields stop before the line end, and a carriage return before it
+        if (!(end = memchr(p, '\n', c->end - p)))
+            end = c->end;
+        stop = end;
+        if (stop > p && stop[-1] == '\r')
+            stop--;
+        if (end < c->end)
+            end++;
+
+        for (i = 0, field = p; ; i++)
+        {
+            const char *next = field_end(field, stop, job->delimiter);
+
+            if (i < job->field_count && job->fields[i].kind != CONVERT_COPY)
+                convert_value(job, c, &job->fields[i], field, next - field);
+            else
+                append(c, field, next - field);
+
+            if (next == stop)
+                break;
+            append(c, next, 1);
+            field = next + 1;
+        }
+        append(c, stop, end - stop);
+        c->lines++;
+    }
+}
+
+static void *convert_worker(void *arg)
+{
+    convert_job *job = arg;
+    size_t i;
+
+    for (;;)
+    {
+        // claim the next chunk, staying within a window of the writer
+        pthread_mutex_lock(&job->lock);
+        while (job->next < job->chunk_count && job->next >= job->written + job->window)
+            pthread_cond_wait(&job->taken, &job->lock);
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->chunk_count)
+            return NULL;
+
+        convert_lines(job, &job->chunks[i]);
+
+        pthread_mutex_lock(&job->lock);
+        job->chunks[i].done = 1;
+        pthread_cond_broadcast(&job->ready);
+        pthread_mutex_unlock(&job->lock);
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    convert_job job;
+    pthread_t *threads;
+    const char *input, *output, *data, *p, *end;
+    unsigned long lines = 0, invalid = 0;
+    long threads_count = 0;
+    int opt, fd, header_line = 0;
+    size_t i, size;
+    struct stat st;
+    double start, seconds;
+    FILE *out = stdout;
+
+    memset(&job, 0, sizeof(job));
+    job.delimiter = '\t';
+
+    while ((opt = getopt(argc, argv, "bc:d:Ht:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            job.binary = 1;
+            break;
+        case 'c':
+            if (parse_field(&job, optarg))
+                die(optarg, "invalid conversion");
+            break;
+        case 'd':
+            if (strlen(optarg) != 1 || *optarg == '\n' || *optarg == '"')
+                die(optarg, "invalid delimiter");
+            job.delimiter = *optarg;
+            break;
+        case 'H':
+            header_line = 1;
+            break;
+        case 't':
+            if ((threads_count = atol(optarg)) < 1)
+                die(optarg, "invalid number of threads");
+            break;
+        default:
+            usage();
+        }
+    }
+    if (!job.field_count || argc - optind < 1 || argc - optind > 2)
+        usage();
+    input = argv[optind];
+    output = argc - optind > 1 ? argv[optind + 1] : NULL;
+
+    if (!threads_count && (threads_count = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        threads_count = 1;
+
+    if ((fd = open(input, O_RDONLY)) < 0 || fstat(fd, &st))
+        die(input, strerror(errno));
+    size = st.st_size;
+    data = "";
+    if (size && (data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        die(input, strerror(errno));
+    close(fd);
+    madvise((void *) data, size, MADV_SEQUENTIAL);
+
+    if (output && !(out = fopen(output, "w")))
+        die(output, strerror(errno));
+
+    start = now();
+    p = data;
+    end = data + size;
+
+    if (header_line && p < end)
+    {
+        p = memchr(data, '\n', size);
+        p = p ? p + 1 : end;
+        if (fwrite(data, p - data, 1, out) != 1)
+            die(output ? output : "stdout", strerror(errno));
+    }
+
+    // chunks of about the same size, each ending after a line end
+    job.chunk_count = (end - p + CONVERT_CHUNK - 1) / CONVERT_CHUNK;
+    job.chunks = xrealloc(NULL, max(job.chunk_count, 1) * sizeof(*job.chunks));
+    memset(job.chunks, 0, max(job.chunk_count, 1) * sizeof(*job.chunks));
+    for (i = 0; p < end; i++)
+    {
+        const char *stop = (size_t) (end - p) > CONVERT_CHUNK ? memchr(p + CONVERT_CHUNK - 1, '\n',
+                end - p - CONVERT_CHUNK + 1) : NULL;
+
+        job.chunks[i].start = p;
+        job.chunks[i].end = p = stop ? stop + 1 : end;
+    }
+    job.chunk_count = i;
+
+    // enough chunks in flight to keep all threads busy while one is written
+    job.window = 2 * threads_count;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.ready, NULL);
+    pthread_cond_init(&job.taken, NULL);
+
+    threads = xrealloc(NULL, threads_count * sizeof(*threads));
+    for (i = 0; i < (size_t) threads_count; i++)
+        if ((errno = pthread_create(&threads[i], NULL, convert_worker, &job)))
+            die("pthread_create", strerror(errno));
+
+    for (i = 0; i < job.chunk_count; i++)
+    {
+        convert_chunk *c = &job.chunks[i];
+
+        pthread_mutex_lock(&job.lock);
+        while (!c->done)
+            pthread_cond_wait(&job.ready, &job.lock);
+        pthread_mutex_unlock(&job.lock);
+
+        if (c->used && fwrite(c->out, c->used, 1, out) != 1)
+            die(output ? output : "stdout", strerror(errno));
+        lines += c->lines;
+        invalid += c->invalid;
+        free(c->out);
+        c->out = NULL;
+
+        pthread_mutex_lock(&job.lock);
+        job.written = i + 1;
+        pthread_cond_broadcast(&job.taken);
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    for (i = 0; i < (size_t) threads_count; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    free(job.chunks);
+    if (size)
+        munmap((void *) data, size);
+
+    if (fflush(out) || (out != stdout && fclose(out)))
+        die(output ? output : "stdout", strerror(errno));
+    seconds = now() - start;
+
+    fprintf(stderr, "udf_convert: %s: %lu lines, %lu invalid values, %.1f MB in %.2f s, %.1f MB/s with %ld threads\n",
+            input, lines, invalid, size / 1e6, seconds, seconds > 0 ? size / 1e6 / seconds : 0, threads_count);
+    return 0;
+}